@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2024-2025 Kamil 'Novik' Nowicki <novik@axisos.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Loads the plugin outside of the panel and drives it through a fixed
+ * workload: construct, popups, reconfigures, drop-in edits and resizes.
+ * Used to record PGO profiles, and with --load-only to time dlopen().
+ *
+ * Usage: applemenu-train [--load-only] MODULE [ITERATIONS]
+ */
+
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <gmodule.h>
+#include <libxfce4panel/libxfce4panel.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+
+#define DEFAULT_ITERATIONS 200
+
+/* Exported by XFCE_PANEL_PLUGIN_REGISTER, called by the panel's module loader */
+typedef XfcePanelPlugin *(*TrainModuleConstruct)(const gchar  *name,
+                                                 gint          unique_id,
+                                                 const gchar  *display_name,
+                                                 const gchar  *comment,
+                                                 gchar       **arguments,
+                                                 GdkScreen    *screen);
+
+/* Run the main loop for a while so idles, monitors and redraws happen */
+static void
+train_pump(guint ms)
+{
+    gint64 end = g_get_monotonic_time() + ms * G_TIME_SPAN_MILLISECOND;
+
+    do {
+        while (gtk_events_pending())
+            gtk_main_iteration();
+        g_usleep(G_TIME_SPAN_MILLISECOND);
+    } while (g_get_monotonic_time() < end);
+}
+
+/* Answer the plugin's settings dialog, if it is open */
+static void
+train_close_dialogs(void)
+{
+    GList *windows, *li;
+
+    windows = gtk_window_list_toplevels();
+    for (li = windows; li != NULL; li = li->next) {
+        if (GTK_IS_DIALOG(li->data) && gtk_widget_get_visible(li->data))
+            gtk_dialog_response(GTK_DIALOG(li->data), GTK_RESPONSE_OK);
+    }
+    g_list_free(windows);
+}
+
+/* Time dlopen() of the module with immediate binding */
+static int
+train_load_only(const gchar *path, guint iterations)
+{
+    gint64 start, total = 0;
+    void *handle;
+    guint i;
+
+    for (i = 0; i < iterations; i++) {
+        start = g_get_monotonic_time();
+        handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        total += g_get_monotonic_time() - start;
+
+        if (handle == NULL) {
+            g_printerr("Failed to load %s: %s\n", path, dlerror());
+            return EXIT_FAILURE;
+        }
+        dlclose(handle);
+    }
+
+    g_print("%.2f\n", (gdouble)total / iterations);
+
+    return EXIT_SUCCESS;
+}
+
+static int
+train_workload(const gchar *path, guint iterations)
+{
+    TrainModuleConstruct module_construct;
+    GModule *module;
+    GtkWidget *window, *plugin, *button;
+    GValue value = G_VALUE_INIT;
+    gchar *dropin_dir, *dropin;
+    gboolean handled, result;
+    gint64 start;
+    guint i;
+
+    module = g_module_open(path, G_MODULE_BIND_LOCAL);
+    if (module == NULL) {
+        g_printerr("Failed to load %s: %s\n", path, g_module_error());
+        return EXIT_FAILURE;
+    }
+    g_module_make_resident(module);
+
+    if (!g_module_symbol(module, "xfce_panel_module_construct", (gpointer *)&module_construct)) {
+        g_printerr("%s is not a panel plugin\n", path);
+        return EXIT_FAILURE;
+    }
+
+    start = g_get_monotonic_time();
+
+    /* Same arguments as the panel, the plugin constructs itself on realize */
+    plugin = GTK_WIDGET(module_construct("applemenu", 1, "Apple Menu", "", NULL,
+                                         gdk_screen_get_default()));
+    if (plugin == NULL) {
+        g_printerr("%s did not construct a plugin\n", path);
+        return EXIT_FAILURE;
+    }
+
+    window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_container_add(GTK_CONTAINER(window), plugin);
+    gtk_widget_show_all(window);
+    train_pump(50);
+
+    button = gtk_bin_get_child(GTK_BIN(plugin));
+
+    dropin_dir = g_build_filename(g_get_user_config_dir(), "xfce4", "panel", "applemenu.d", NULL);
+    dropin = g_build_filename(dropin_dir, "train.desktop", NULL);
+    g_mkdir_with_parents(dropin_dir, 0700);
+
+    g_value_init(&value, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&value, TRUE);
+
+    for (i = 0; i < iterations; i++) {
+        /* Open and close by click and by remote event */
+        gtk_button_clicked(GTK_BUTTON(button));
+        train_pump(2);
+        gtk_button_clicked(GTK_BUTTON(button));
+        train_pump(1);
+        g_signal_emit_by_name(plugin, "remote-event", "popup", &value, &handled);
+        train_pump(2);
+        g_signal_emit_by_name(plugin, "remote-event", "popup", &value, &handled);
+
+        /* Panel resizes */
+        g_signal_emit_by_name(plugin, "size-changed", 16 + (i % 4) * 8, &result);
+
+        /* Reconfigure */
+        if (i % 10 == 0) {
+            g_signal_emit_by_name(plugin, "configure-plugin");
+            train_pump(5);
+            train_close_dialogs();
+            g_signal_emit_by_name(plugin, "save");
+        }
+
+        /* Add, edit and remove a drop-in item */
+        if (i % 20 == 0) {
+            g_file_set_contents(dropin,
+                                "[Desktop Entry]\n"
+                                "Type=Application\n"
+                                "Name=Train\n"
+                                "Exec=true\n", -1, NULL);
+            train_pump(20);
+            g_unlink(dropin);
+            train_pump(20);
+        }
+    }
+
+    g_print("Ran %u iterations in %.1f ms\n", iterations,
+            (g_get_monotonic_time() - start) / 1000.0);
+
+    g_value_unset(&value);
+    g_free(dropin);
+    g_free(dropin_dir);
+
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+    gboolean load_only = FALSE;
+    guint iterations = DEFAULT_ITERATIONS;
+    gint arg = 1;
+
+    if (argc > arg && g_strcmp0(argv[arg], "--load-only") == 0) {
+        load_only = TRUE;
+        arg++;
+    }
+
+    if (argc <= arg) {
+        g_printerr("Usage: %s [--load-only] MODULE [ITERATIONS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc > arg + 1)
+        iterations = MAX(atoi(argv[arg + 1]), 1);
+
+    if (load_only)
+        return train_load_only(argv[arg], iterations);
+
+    gtk_init(&argc, &argv);
+
+    return train_workload(argv[arg], iterations);
+}
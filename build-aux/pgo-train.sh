@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Run the training workload against a plugin built with -Dpgo=generate.
+#
+# Usage: pgo-train.sh TRAIN_EXE MODULE PGO_DATA_DIR [ITERATIONS]
+
+set -e
+
+TRAIN="$1"
+MODULE="$2"
+PGO_DATA_DIR="$3"
+ITERATIONS="${4:-200}"
+
+mkdir -p "$PGO_DATA_DIR"
+
+# Keep the workload away from the user's own configuration
+XDG_CONFIG_HOME=$(mktemp -d)
+export XDG_CONFIG_HOME
+trap 'rm -rf "$XDG_CONFIG_HOME"' EXIT
+
+if [ -z "$DISPLAY" ] && [ -z "$WAYLAND_DISPLAY" ]; then
+    if ! command -v xvfb-run >/dev/null 2>&1; then
+        echo "No display and no xvfb-run, cannot run the workload" >&2
+        exit 1
+    fi
+    xvfb-run -a "$TRAIN" "$MODULE" "$ITERATIONS"
+else
+    "$TRAIN" "$MODULE" "$ITERATIONS"
+fi
+
+if [ -z "$(find "$PGO_DATA_DIR" -name '*.gcda' 2>/dev/null)" ]; then
+    echo "No profile written to $PGO_DATA_DIR, was the plugin configured with -Dpgo=generate?" >&2
+    exit 1
+fi
+
+echo "Profile written to $PGO_DATA_DIR"
+echo "Reconfigure with 'meson configure -Dpgo=use' and rebuild"
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Report exported symbols, relocations and load time of the plugin, and the
+# difference against a baseline build when one is given, either as the third
+# argument or through APPLEMENU_BASELINE (which is how `ninja so-report`
+# receives it). Without a baseline only absolute numbers are printed.
+#
+# Usage: so-report.sh TRAIN_EXE MODULE [BASELINE_MODULE]
+
+set -e
+
+TRAIN="$1"
+MODULE="$2"
+BASELINE="${3:-$APPLEMENU_BASELINE}"
+
+# Sets exported, relocs and load for the module in $1
+report() {
+    size=$(wc -c < "$1")
+    exported=$(nm -D --defined-only "$1" | wc -l)
+    relocs=$(readelf -r --wide "$1" | grep -c ' R_' || true)
+    relative=$(readelf -r --wide "$1" | grep -c '_RELATIVE' || true)
+    load=$("$TRAIN" --load-only "$1" 1000)
+
+    echo "$1"
+    echo "  size:               $size bytes"
+    echo "  exported symbols:   $exported"
+    echo "  relocations:        $relocs ($((relocs - relative)) symbolic, $relative relative)"
+    echo "  dlopen (RTLD_NOW):  $load us"
+}
+
+report "$MODULE"
+
+if [ -z "$BASELINE" ]; then
+    echo "No baseline given, set APPLEMENU_BASELINE to a plain build's module to see the improvement"
+    exit 0
+fi
+
+module_exported=$exported
+module_relocs=$relocs
+module_load=$load
+
+report "$BASELINE"
+
+echo "Difference against baseline"
+echo "  exported symbols:   $((module_exported - exported))"
+echo "  relocations:        $((module_relocs - relocs))"
+echo "  dlopen (RTLD_NOW):  $(awk -v new="$module_load" -v old="$load" \
+    'BEGIN { printf "%+.2f us (%+.1f%%)", new - old, (old > 0 ? (new - old) * 100 / old : 0) }')"
@@ -21,16 +21,84 @@
 #endif
 
 #include <gtk/gtk.h>
+#ifdef HAVE_X11
+#include <gdk/gdkx.h>
+#endif
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <gio/gdesktopappinfo.h>
 #include <libxfce4panel/libxfce4panel.h>
 #include <libxfce4ui/libxfce4ui.h>
 #include <libxfce4util/libxfce4util.h>
 #include <exo/exo.h>
 #include <dbus/dbus-glib.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/utsname.h>
 
 #include "applemenu.h"
 
+/* logind service used to suspend and to hold the sleep inhibitor */
+#define LOGIND_BUS_NAME       "org.freedesktop.login1"
+#define LOGIND_OBJECT_PATH    "/org/freedesktop/login1"
+#define LOGIND_MANAGER_IFACE  "org.freedesktop.login1.Manager"
+
+/* power-profiles-daemon */
+#define POWER_PROFILES_BUS_NAME     "net.hadess.PowerProfiles"
+#define POWER_PROFILES_OBJECT_PATH  "/net/hadess/PowerProfiles"
+#define POWER_PROFILES_IFACE        "net.hadess.PowerProfiles"
+
+/* Screen lockers reachable over the session bus, in order of preference */
+typedef struct {
+    const gchar *bus_name;
+    const gchar *object_path;
+    const gchar *interface;
+} AppleMenuLocker;
+
+static const AppleMenuLocker applemenu_lockers[] = {
+    { "org.xfce.ScreenSaver",         "/org/xfce/ScreenSaver",         "org.xfce.ScreenSaver" },
+    { "org.freedesktop.ScreenSaver",  "/org/freedesktop/ScreenSaver",  "org.freedesktop.ScreenSaver" },
+    { "org.gnome.ScreenSaver",        "/org/gnome/ScreenSaver",        "org.gnome.ScreenSaver" },
+    { "org.mate.ScreenSaver",         "/org/mate/ScreenSaver",         "org.mate.ScreenSaver" },
+};
+
+/* Drop-in items without a position go right after this built-in item */
+#define APPLEMENU_CUSTOM_ANCHOR "app-store"
+
+/* Built-in menu item description */
+typedef struct {
+    AppleMenuItemType  type;
+    const gchar       *id;
+    const gchar       *label;
+    const gchar       *icon_name;
+    GCallback          activate;
+} AppleMenuBuiltinItem;
+
+/* Per-item settings read from the [item-<id>] groups of the rc file */
+typedef struct {
+    gboolean  hidden;
+    gboolean  has_position;
+    gint      position;
+} AppleMenuItemOverride;
+
+/* Menu placement that needed no flipping for one geometry key */
+typedef struct {
+    GdkGravity  rect_anchor;
+    GdkGravity  menu_anchor;
+} AppleMenuGeometry;
+
+/* A menu row, built-in or drop-in */
+typedef struct {
+    AppleMenuItemType            type;
+    gchar                       *id;
+    gint                         position;
+    gboolean                     hidden;
+    const AppleMenuBuiltinItem  *builtin;
+    GDesktopAppInfo             *app_info;
+    GtkWidget                   *widget;   /* NULL while not in the menu */
+} AppleMenuEntry;
+
 /* Plugin structure */
 typedef struct {
     XfcePanelPlugin *plugin;
@@ -38,6 +106,7 @@ typedef struct {
     GtkWidget       *icon;
     GtkWidget       *menu;
     gboolean         menu_visible;  /* Track menu visibility state */
+    GtkWidget       *config_dialog; /* Single instance, hidden on close */
     
     /* Configuration */
     gboolean         show_recent_items;
@@ -46,19 +115,71 @@ typedef struct {
     gchar           *custom_icon_name;
     gchar           *app_store_command;
     gint             transparency;
+    gboolean         lock_on_sleep;
+    GHashTable      *item_overrides;        /* id -> AppleMenuItemOverride */
+    gchar           *popup_shortcut;        /* GTK accelerator, empty for none */
+    
+    /* Menu rows sorted by position, and the drop-in directory watch */
+    GList           *entries;
+    gchar           *dropin_dir;
+    GFileMonitor    *dropin_monitor;
+    
+    /* Menu warm-up: realized and measured ahead of the first popup */
+    guint            premeasure_id;
+    gboolean         menu_measured;
+    gint64           popup_start_time;      /* non-zero until the popup paints */
+    gboolean         popup_warm;
+    
+    /* Final popup anchors per monitor/position/size/scale */
+    GHashTable      *geometry_cache;        /* key -> AppleMenuGeometry */
+    gchar           *geometry_key;          /* key of the current popup */
+    
+#ifdef HAVE_X11
+    /* Global shortcut grab on the root window */
+    guint            hotkey_keycode;
+    guint            hotkey_modifiers;
+    gboolean         hotkey_pressed;
+    guint            hotkey_popup_id;
+#endif
+    
+    /* Pending D-Bus calls, cancelled when the plugin is freed */
+    GCancellable    *cancellable;
+    
+    /* Lock-on-sleep state */
+    gint             sleep_inhibit_fd;      /* logind delay inhibitor, -1 if none */
+    gboolean         sleep_locked;          /* locker confirmed for this suspend */
+    guint            sleep_timeout_id;      /* non-zero while a suspend is in flight */
+    gint64           sleep_start_time;
+    GDBusConnection *sleep_session_bus;
+    guint            sleep_active_ids[G_N_ELEMENTS(applemenu_lockers)];  /* ActiveChanged watches */
+    
+    /* Screen locker found at startup, NULL falls back to xflock4 */
+    GDBusProxy      *locker_proxy;
+    gint64           lock_start_time;
+    
+    /* power-profiles-daemon, drives the Performance Mode submenu */
+    GDBusProxy      *power_proxy;
+    gboolean         power_updating;        /* submenu is being synced, ignore toggles */
 } AppleMenuPlugin;
 
 /* Prototypes */
 static void applemenu_construct(XfcePanelPlugin *plugin);
 static void applemenu_free_data(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu);
-static void applemenu_position_menu(GtkMenu *menu, gint *x, gint *y, gboolean *push_in, gpointer data);
+static void applemenu_geometry_invalidate(AppleMenuPlugin *applemenu);
 static void applemenu_button_clicked(GtkWidget *button, AppleMenuPlugin *applemenu);
 static void applemenu_create_menu(AppleMenuPlugin *applemenu);
+static void applemenu_menu_invalidate(AppleMenuPlugin *applemenu);
+static void applemenu_popup(AppleMenuPlugin *applemenu);
+static void applemenu_hotkey_grab(AppleMenuPlugin *applemenu);
+static void applemenu_hotkey_ungrab(AppleMenuPlugin *applemenu);
+static gboolean applemenu_remote_event(XfcePanelPlugin *plugin, const gchar *name, const GValue *value, AppleMenuPlugin *applemenu);
 static gboolean applemenu_size_changed(XfcePanelPlugin *plugin, guint size, AppleMenuPlugin *applemenu);
 static void applemenu_orientation_changed(XfcePanelPlugin *plugin, GtkOrientation orientation, AppleMenuPlugin *applemenu);
 static void applemenu_configure_plugin(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu);
 static void applemenu_save_config(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu);
 static void applemenu_load_config(AppleMenuPlugin *applemenu);
+static void applemenu_load_items(AppleMenuPlugin *applemenu);
+static void applemenu_entry_free(gpointer data);
 
 /* Menu callbacks */
 static void applemenu_about_computer(GtkMenuItem *item G_GNUC_UNUSED, gpointer data);
@@ -68,12 +189,39 @@ static void applemenu_force_quit(GtkMenuItem *item G_GNUC_UNUSED, gpointer data)
 static void applemenu_sleep(GtkMenuItem *item G_GNUC_UNUSED, gpointer data);
 static void applemenu_restart(GtkMenuItem *item G_GNUC_UNUSED, gpointer data);
 static void applemenu_shutdown(GtkMenuItem *item G_GNUC_UNUSED, gpointer data);
+static void applemenu_locker_discover(AppleMenuPlugin *applemenu, guint index);
+static void applemenu_lock(AppleMenuPlugin *applemenu);
+static void applemenu_sleep_locked(AppleMenuPlugin *applemenu);
+static void applemenu_sleep_unwatch(AppleMenuPlugin *applemenu);
+static void applemenu_power_connect(AppleMenuPlugin *applemenu);
+static gboolean applemenu_power_available(AppleMenuPlugin *applemenu);
+static void applemenu_power_fill_submenu(AppleMenuPlugin *applemenu, GtkWidget *submenu);
 static void applemenu_lock_screen(GtkMenuItem *item G_GNUC_UNUSED, gpointer data);
 static void applemenu_logout(GtkMenuItem *item G_GNUC_UNUSED, gpointer data);
 static void applemenu_on_menu_show(GtkWidget *menu, gpointer data);
 static void applemenu_on_menu_hide(GtkWidget *menu, gpointer data);
 static void applemenu_on_menu_deactivate(GtkWidget *menu, gpointer data);
 
+/* Built-in menu, in default order */
+static const AppleMenuBuiltinItem applemenu_builtin_items[] = {
+    { MENU_ITEM_ABOUT,       "about",             N_("_About This Computer"),    "computer",                G_CALLBACK(applemenu_about_computer) },
+    { MENU_ITEM_SEPARATOR,   "separator-about",   NULL,                          NULL,                      NULL },
+    { MENU_ITEM_PREFERENCES, "preferences",       N_("System _Preferences..."),  "preferences-system",      G_CALLBACK(applemenu_system_preferences) },
+    { MENU_ITEM_APP_STORE,   "app-store",         N_("_App Store..."),           "system-software-install", G_CALLBACK(applemenu_app_store) },
+    { MENU_ITEM_SEPARATOR,   "separator-apps",    NULL,                          NULL,                      NULL },
+    { MENU_ITEM_RECENT,      "recent",            N_("Recent _Items"),           "document-open-recent",    NULL },
+    { MENU_ITEM_SEPARATOR,   "separator-recent",  NULL,                          NULL,                      NULL },
+    { MENU_ITEM_FORCE_QUIT,  "force-quit",        N_("_Force Quit..."),          "process-stop",            G_CALLBACK(applemenu_force_quit) },
+    { MENU_ITEM_SEPARATOR,   "separator-power",   NULL,                          NULL,                      NULL },
+    { MENU_ITEM_POWER_PROFILE, "power-profile",   N_("_Performance Mode"),       "preferences-system-power", NULL },
+    { MENU_ITEM_SLEEP,       "sleep",             N_("_Sleep"),                  "system-suspend",          G_CALLBACK(applemenu_sleep) },
+    { MENU_ITEM_RESTART,     "restart",           N_("_Restart..."),             "system-reboot",           G_CALLBACK(applemenu_restart) },
+    { MENU_ITEM_SHUTDOWN,    "shutdown",          N_("Shut _Down..."),           "system-shutdown",         G_CALLBACK(applemenu_shutdown) },
+    { MENU_ITEM_SEPARATOR,   "separator-session", NULL,                          NULL,                      NULL },
+    { MENU_ITEM_LOCK,        "lock",              N_("_Lock Screen"),            "system-lock-screen",      G_CALLBACK(applemenu_lock_screen) },
+    { MENU_ITEM_LOGOUT,      "logout",            N_("Log Out %s..."),           "system-log-out",          G_CALLBACK(applemenu_logout) },
+};
+
 /* Register the plugin */
 XFCE_PANEL_PLUGIN_REGISTER(applemenu_construct);
 
@@ -94,8 +242,14 @@ applemenu_construct(XfcePanelPlugin *plugin)
     applemenu->use_apple_logo = TRUE;
     applemenu->custom_icon_name = g_strdup(APPLEMENU_ICON_NAME);
     applemenu->app_store_command = g_strdup(DEFAULT_APP_STORE_COMMAND);
+    applemenu->popup_shortcut = g_strdup(DEFAULT_POPUP_SHORTCUT);
     applemenu->transparency = DEFAULT_TRANSPARENCY;
+    applemenu->lock_on_sleep = DEFAULT_LOCK_ON_SLEEP;
     applemenu->menu_visible = FALSE;
+    applemenu->item_overrides = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    applemenu->geometry_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    applemenu->cancellable = g_cancellable_new();
+    applemenu->sleep_inhibit_fd = -1;
     
     /* Create button */
     applemenu->button = xfce_panel_create_button();
@@ -134,10 +288,34 @@ applemenu_construct(XfcePanelPlugin *plugin)
                      G_CALLBACK(applemenu_orientation_changed), applemenu);
     g_signal_connect(G_OBJECT(plugin), "configure-plugin",
                      G_CALLBACK(applemenu_configure_plugin), applemenu);
-    
-    /* Create menu */
+    g_signal_connect(G_OBJECT(plugin), "remote-event",
+                     G_CALLBACK(applemenu_remote_event), applemenu);
+    
+    /* Re-measure the menu when the scale or icon theme changes */
+    g_signal_connect_swapped(G_OBJECT(plugin), "notify::scale-factor",
+                             G_CALLBACK(applemenu_menu_invalidate), applemenu);
+    g_signal_connect_swapped(G_OBJECT(gtk_widget_get_settings(GTK_WIDGET(plugin))), "notify::gtk-icon-theme-name",
+                             G_CALLBACK(applemenu_menu_invalidate), applemenu);
+    
+    /* Cached popup geometry is stale after monitor hotplug or a mode change */
+    g_signal_connect_swapped(G_OBJECT(gtk_widget_get_display(GTK_WIDGET(plugin))), "monitor-added",
+                             G_CALLBACK(applemenu_geometry_invalidate), applemenu);
+    g_signal_connect_swapped(G_OBJECT(gtk_widget_get_display(GTK_WIDGET(plugin))), "monitor-removed",
+                             G_CALLBACK(applemenu_geometry_invalidate), applemenu);
+    g_signal_connect_swapped(G_OBJECT(gtk_widget_get_screen(GTK_WIDGET(plugin))), "monitors-changed",
+                             G_CALLBACK(applemenu_geometry_invalidate), applemenu);
+    
+    /* Collect menu items and create menu */
+    applemenu_load_items(applemenu);
     applemenu_create_menu(applemenu);
     
+    /* Global shortcut */
+    applemenu_hotkey_grab(applemenu);
+    
+    /* Look for a screen locker and power-profiles-daemon in the background */
+    applemenu_locker_discover(applemenu, 0);
+    applemenu_power_connect(applemenu);
+    
     /* Show properties dialog on first use */
     xfce_panel_plugin_menu_show_configure(plugin);
     
@@ -147,32 +325,208 @@ applemenu_construct(XfcePanelPlugin *plugin)
 
 /* Free plugin data */
 static void
-applemenu_free_data(XfcePanelPlugin *plugin G_GNUC_UNUSED, AppleMenuPlugin *applemenu)
+applemenu_free_data(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu)
 {
+    /* Nothing may call back into the plugin from here on */
+    g_signal_handlers_disconnect_by_data(plugin, applemenu);
+    
+    /* Destroy the settings dialog */
+    if (applemenu->config_dialog)
+        gtk_widget_destroy(applemenu->config_dialog);
+    
+    /* Abort pending D-Bus calls and drop a held sleep inhibitor */
+    g_cancellable_cancel(applemenu->cancellable);
+    g_object_unref(applemenu->cancellable);
+    
+    if (applemenu->sleep_timeout_id != 0)
+        g_source_remove(applemenu->sleep_timeout_id);
+    if (applemenu->sleep_inhibit_fd >= 0)
+        close(applemenu->sleep_inhibit_fd);
+    applemenu_sleep_unwatch(applemenu);
+    if (applemenu->locker_proxy)
+        g_object_unref(applemenu->locker_proxy);
+    if (applemenu->power_proxy) {
+        g_signal_handlers_disconnect_by_data(applemenu->power_proxy, applemenu);
+        g_object_unref(applemenu->power_proxy);
+    }
+    
+    /* Drop the shortcut and pending warm-up */
+    applemenu_hotkey_ungrab(applemenu);
+    if (applemenu->premeasure_id != 0)
+        g_source_remove(applemenu->premeasure_id);
+    g_signal_handlers_disconnect_by_data(gtk_widget_get_settings(GTK_WIDGET(plugin)), applemenu);
+    g_signal_handlers_disconnect_by_data(gtk_widget_get_display(GTK_WIDGET(plugin)), applemenu);
+    g_signal_handlers_disconnect_by_data(gtk_widget_get_screen(GTK_WIDGET(plugin)), applemenu);
+    
+    /* Stop watching drop-ins */
+    if (applemenu->dropin_monitor) {
+        g_signal_handlers_disconnect_by_data(applemenu->dropin_monitor, applemenu);
+        g_file_monitor_cancel(applemenu->dropin_monitor);
+        g_object_unref(applemenu->dropin_monitor);
+    }
+    g_free(applemenu->dropin_dir);
+    
     /* Destroy menu */
-    if (applemenu->menu)
+    if (applemenu->menu) {
+        g_signal_handlers_disconnect_by_data(applemenu->menu, applemenu);
         gtk_widget_destroy(applemenu->menu);
+    }
+    g_list_free_full(applemenu->entries, applemenu_entry_free);
     
     /* Free configuration */
     g_free(applemenu->custom_icon_name);
     g_free(applemenu->app_store_command);
+    g_free(applemenu->popup_shortcut);
+    g_hash_table_destroy(applemenu->item_overrides);
+    g_hash_table_destroy(applemenu->geometry_cache);
+    g_free(applemenu->geometry_key);
     
     /* Free plugin structure */
     g_slice_free(AppleMenuPlugin, applemenu);
 }
 
-/* Position menu */
+/* Anchor the menu on the side of the button that faces away from the
+ * screen edge the panel is attached to */
 static void
-applemenu_position_menu(GtkMenu *menu, gint *x, gint *y, gboolean *push_in, gpointer data)
+applemenu_menu_anchors(AppleMenuPlugin *applemenu, GdkGravity *rect_anchor, GdkGravity *menu_anchor)
 {
-    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
-    xfce_panel_plugin_position_menu(menu, x, y, push_in, applemenu->plugin);
+    XfceScreenPosition position = xfce_panel_plugin_get_screen_position(applemenu->plugin);
+    
+    if (xfce_screen_position_is_bottom(position)) {
+        *rect_anchor = GDK_GRAVITY_NORTH_WEST;
+        *menu_anchor = GDK_GRAVITY_SOUTH_WEST;
+    } else if (xfce_screen_position_is_left(position)) {
+        *rect_anchor = GDK_GRAVITY_NORTH_EAST;
+        *menu_anchor = GDK_GRAVITY_NORTH_WEST;
+    } else if (xfce_screen_position_is_right(position)) {
+        *rect_anchor = GDK_GRAVITY_NORTH_WEST;
+        *menu_anchor = GDK_GRAVITY_NORTH_EAST;
+    } else if (position == XFCE_SCREEN_POSITION_FLOATING_V) {
+        *rect_anchor = GDK_GRAVITY_NORTH_EAST;
+        *menu_anchor = GDK_GRAVITY_NORTH_WEST;
+    } else {
+        /* Top and floating horizontal panels */
+        *rect_anchor = GDK_GRAVITY_SOUTH_WEST;
+        *menu_anchor = GDK_GRAVITY_NORTH_WEST;
+    }
 }
 
-/* Handle button click */
+/* Mirror a gravity horizontally and/or vertically */
+static GdkGravity
+applemenu_gravity_flip(GdkGravity gravity, gboolean flip_x, gboolean flip_y)
+{
+    gint column = (gravity - GDK_GRAVITY_NORTH_WEST) % 3;
+    gint row = (gravity - GDK_GRAVITY_NORTH_WEST) / 3;
+    
+    if (gravity < GDK_GRAVITY_NORTH_WEST || gravity > GDK_GRAVITY_SOUTH_EAST)
+        return gravity;
+    
+    if (flip_x)
+        column = 2 - column;
+    if (flip_y)
+        row = 2 - row;
+    
+    return GDK_GRAVITY_NORTH_WEST + row * 3 + column;
+}
+
+/* Cache key: monitor, panel position (and with it orientation), size and scale */
+static gchar *
+applemenu_geometry_key(AppleMenuPlugin *applemenu)
+{
+    GdkDisplay *display = gtk_widget_get_display(applemenu->button);
+    GdkWindow *window = gtk_widget_get_window(applemenu->button);
+    GdkMonitor *monitor;
+    gint i, n_monitors, index = -1;
+    
+    if (window == NULL)
+        return NULL;
+    
+    monitor = gdk_display_get_monitor_at_window(display, window);
+    n_monitors = gdk_display_get_n_monitors(display);
+    for (i = 0; i < n_monitors; i++) {
+        if (gdk_display_get_monitor(display, i) == monitor) {
+            index = i;
+            break;
+        }
+    }
+    
+    return g_strdup_printf("%d:%d:%d:%d", index,
+                           xfce_panel_plugin_get_screen_position(applemenu->plugin),
+                           xfce_panel_plugin_get_size(applemenu->plugin),
+                           gtk_widget_get_scale_factor(applemenu->button));
+}
+
+/* Remember where GTK finally put the menu, flips included */
 static void
-applemenu_button_clicked(GtkWidget *button G_GNUC_UNUSED, AppleMenuPlugin *applemenu)
+applemenu_on_menu_popped_up(GtkMenu *menu G_GNUC_UNUSED,
+                            gpointer flipped_rect G_GNUC_UNUSED,
+                            gpointer final_rect G_GNUC_UNUSED,
+                            gboolean flipped_x,
+                            gboolean flipped_y,
+                            AppleMenuPlugin *applemenu)
+{
+    AppleMenuGeometry *geometry;
+    GdkGravity rect_anchor, menu_anchor;
+    
+    if (applemenu->geometry_key == NULL
+        || g_hash_table_contains(applemenu->geometry_cache, applemenu->geometry_key))
+        return;
+    
+    applemenu_menu_anchors(applemenu, &rect_anchor, &menu_anchor);
+    
+    geometry = g_new0(AppleMenuGeometry, 1);
+    geometry->rect_anchor = applemenu_gravity_flip(rect_anchor, flipped_x, flipped_y);
+    geometry->menu_anchor = applemenu_gravity_flip(menu_anchor, flipped_x, flipped_y);
+    g_hash_table_insert(applemenu->geometry_cache, g_strdup(applemenu->geometry_key), geometry);
+    
+    g_debug("Cached menu geometry for %s (flipped x: %d, y: %d)",
+            applemenu->geometry_key, flipped_x, flipped_y);
+}
+
+/* Monitors, theme, scale or menu content changed */
+static void
+applemenu_geometry_invalidate(AppleMenuPlugin *applemenu)
+{
+    g_hash_table_remove_all(applemenu->geometry_cache);
+}
+
+/* Event that opens the menu. The shortcut idle and the remote event run
+ * without one, so build a button press on the seat pointer the way the
+ * panel's own popup helpers do, instead of letting GTK guess a device */
+static GdkEvent *
+applemenu_popup_trigger(AppleMenuPlugin *applemenu)
+{
+    GdkEvent *event;
+    GdkWindow *window;
+    GdkSeat *seat;
+    
+    event = gtk_get_current_event();
+    if (event != NULL)
+        return event;
+    
+    window = gtk_widget_get_window(applemenu->button);
+    if (window == NULL)
+        window = gdk_screen_get_root_window(gtk_widget_get_screen(applemenu->button));
+    seat = gdk_display_get_default_seat(gtk_widget_get_display(applemenu->button));
+    
+    event = gdk_event_new(GDK_BUTTON_PRESS);
+    event->button.window = g_object_ref(window);
+    event->button.time = GDK_CURRENT_TIME;
+    event->button.button = 1;
+    gdk_event_set_device(event, gdk_seat_get_pointer(seat));
+    
+    return event;
+}
+
+/* Open or close the menu */
+static void
+applemenu_popup(AppleMenuPlugin *applemenu)
 {
+    AppleMenuGeometry *geometry;
+    GdkGravity rect_anchor, menu_anchor;
+    GdkAnchorHints anchor_hints;
+    GdkEvent *trigger;
+    
     /* Toggle menu visibility */
     if (applemenu->menu_visible) {
         /* Menu is visible, close it */
@@ -181,320 +535,1506 @@ applemenu_button_clicked(GtkWidget *button G_GNUC_UNUSED, AppleMenuPlugin *apple
         applemenu->menu_visible = FALSE;
     } else {
         /* Menu is not visible, show it */
+        applemenu->popup_start_time = g_get_monotonic_time();
+        applemenu->popup_warm = applemenu->menu_measured;
+        
+        g_free(applemenu->geometry_key);
+        applemenu->geometry_key = applemenu_geometry_key(applemenu);
+        geometry = applemenu->geometry_key != NULL
+                   ? g_hash_table_lookup(applemenu->geometry_cache, applemenu->geometry_key)
+                   : NULL;
+        
+        if (geometry != NULL) {
+            /* Known placement, the cached anchors already hold the flip.
+             * Keep resizing, the menu may have been shrunk to fit */
+            rect_anchor = geometry->rect_anchor;
+            menu_anchor = geometry->menu_anchor;
+            anchor_hints = GDK_ANCHOR_SLIDE | GDK_ANCHOR_RESIZE;
+        } else {
+            applemenu_menu_anchors(applemenu, &rect_anchor, &menu_anchor);
+            anchor_hints = GDK_ANCHOR_FLIP | GDK_ANCHOR_SLIDE | GDK_ANCHOR_RESIZE;
+        }
+        
+        g_object_set(G_OBJECT(applemenu->menu), "anchor-hints", anchor_hints, NULL);
+        trigger = applemenu_popup_trigger(applemenu);
         gtk_menu_popup_at_widget(GTK_MENU(applemenu->menu),
                                  applemenu->button,
-                                 GDK_GRAVITY_SOUTH_WEST,
-                                 GDK_GRAVITY_NORTH_WEST,
-                                 NULL);
+                                 rect_anchor,
+                                 menu_anchor,
+                                 trigger);
+        gdk_event_free(trigger);
     }
 }
 
-/* Create menu */
+/* Handle button click */
 static void
-applemenu_create_menu(AppleMenuPlugin *applemenu)
+applemenu_button_clicked(GtkWidget *button G_GNUC_UNUSED, AppleMenuPlugin *applemenu)
+{
+    applemenu_popup(applemenu);
+}
+
+/* Handle xfce4-panel --plugin-event=applemenu:popup:bool:true */
+static gboolean
+applemenu_remote_event(XfcePanelPlugin *plugin G_GNUC_UNUSED,
+                       const gchar *name,
+                       const GValue *value G_GNUC_UNUSED,
+                       AppleMenuPlugin *applemenu)
 {
-    GtkWidget *menu, *item, *image;
+    if (g_strcmp0(name, "popup") != 0)
+        return FALSE;
     
-    /* Create menu */
-    menu = gtk_menu_new();
-    applemenu->menu = menu;
+    applemenu_popup(applemenu);
+    return TRUE;
+}
+
+/* Realize the menu window and resolve styles and sizes while idle, so the
+ * popup only has to map and paint */
+static gboolean
+applemenu_menu_premeasure(gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GtkRequisition requisition;
+    gint64 start = g_get_monotonic_time();
     
-    /* Connect menu signals to track visibility and sync with button */
-    g_signal_connect(G_OBJECT(menu), "show", 
-                     G_CALLBACK(applemenu_on_menu_show), applemenu);
-    g_signal_connect(G_OBJECT(menu), "hide", 
-                     G_CALLBACK(applemenu_on_menu_hide), applemenu);
-    g_signal_connect(G_OBJECT(menu), "deactivate",
-                     G_CALLBACK(applemenu_on_menu_deactivate), applemenu);
+    applemenu->premeasure_id = 0;
+    
+    if (applemenu->menu == NULL || applemenu->menu_visible)
+        return G_SOURCE_REMOVE;
+    
+    gtk_widget_realize(applemenu->menu);
+    gtk_widget_get_preferred_size(applemenu->menu, NULL, &requisition);
+    applemenu->menu_measured = TRUE;
+    
+    g_debug("Menu pre-measured at %dx%d in %.2f ms",
+            requisition.width, requisition.height,
+            (g_get_monotonic_time() - start) / 1000.0);
+    
+    return G_SOURCE_REMOVE;
+}
+
+/* Theme, scale or content changed, measure again on the next idle */
+static void
+applemenu_menu_invalidate(AppleMenuPlugin *applemenu)
+{
+    applemenu->menu_measured = FALSE;
+    applemenu_geometry_invalidate(applemenu);
+    
+    if (applemenu->premeasure_id == 0)
+        applemenu->premeasure_id = g_idle_add_full(G_PRIORITY_LOW, applemenu_menu_premeasure,
+                                                   applemenu, NULL);
+}
+
+static void
+applemenu_on_menu_style_updated(GtkWidget *menu G_GNUC_UNUSED, AppleMenuPlugin *applemenu)
+{
+    /* The first style resolution is part of the measurement itself */
+    if (applemenu->menu_measured)
+        applemenu_menu_invalidate(applemenu);
+}
+
+/* Report click-to-paint latency of the popup */
+static gboolean
+applemenu_on_menu_draw(GtkWidget *menu G_GNUC_UNUSED, cairo_t *cr G_GNUC_UNUSED, AppleMenuPlugin *applemenu)
+{
+    if (applemenu->popup_start_time != 0) {
+        g_debug("Menu painted %.2f ms after open (%s)",
+                (g_get_monotonic_time() - applemenu->popup_start_time) / 1000.0,
+                applemenu->popup_warm ? "warm" : "cold");
+        applemenu->popup_start_time = 0;
+        applemenu->menu_measured = TRUE;
+    }
+    
+    return FALSE;
+}
+
+#ifdef HAVE_X11
+/* Lock and NumLock must not stop the shortcut from matching */
+static const guint applemenu_hotkey_ignored_modifiers[] = {
+    0, LockMask, Mod2Mask, LockMask | Mod2Mask
+};
+
+static gboolean
+applemenu_hotkey_popup_idle(gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    
+    applemenu->hotkey_popup_id = 0;
+    applemenu_popup(applemenu);
+    
+    return G_SOURCE_REMOVE;
+}
+
+static GdkFilterReturn
+applemenu_hotkey_filter(GdkXEvent *gdk_xevent, GdkEvent *event G_GNUC_UNUSED, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    XEvent *xevent = (XEvent *)gdk_xevent;
+    
+    if ((xevent->type != KeyPress && xevent->type != KeyRelease)
+        || xevent->xkey.keycode != applemenu->hotkey_keycode)
+        return GDK_FILTER_CONTINUE;
+    
+    /* Open on release, once the passive grab has ended, so the menu can grab */
+    if (xevent->type == KeyPress) {
+        if ((xevent->xkey.state & ~(LockMask | Mod2Mask)) != applemenu->hotkey_modifiers)
+            return GDK_FILTER_CONTINUE;
+        applemenu->hotkey_pressed = TRUE;
+    } else {
+        /* The modifiers may already be up, e.g. Super let go before space */
+        if (!applemenu->hotkey_pressed)
+            return GDK_FILTER_CONTINUE;
+        applemenu->hotkey_pressed = FALSE;
+        if (applemenu->hotkey_popup_id == 0)
+            applemenu->hotkey_popup_id = g_idle_add(applemenu_hotkey_popup_idle, applemenu);
+    }
+    
+    return GDK_FILTER_REMOVE;
+}
+#endif
+
+/* Grab the configured shortcut on the root window */
+static void
+applemenu_hotkey_grab(AppleMenuPlugin *applemenu)
+{
+#ifdef HAVE_X11
+    GdkDisplay *display = gdk_display_get_default();
+    GdkWindow *root;
+    GdkModifierType modifiers;
+    guint keyval, i;
+    
+    if (applemenu->popup_shortcut == NULL || *applemenu->popup_shortcut == '\0')
+        return;
+    
+    if (!GDK_IS_X11_DISPLAY(display)) {
+        g_debug("Global shortcut needs X11, use the popup remote event instead");
+        return;
+    }
+    
+    gtk_accelerator_parse(applemenu->popup_shortcut, &keyval, &modifiers);
+    if (keyval == 0) {
+        g_warning("Invalid shortcut \"%s\"", applemenu->popup_shortcut);
+        return;
+    }
+    
+    /* Resolve Super/Hyper/Meta to the real Mod bits */
+    gdk_keymap_map_virtual_modifiers(gdk_keymap_get_for_display(display), &modifiers);
+    
+    applemenu->hotkey_keycode = XKeysymToKeycode(GDK_DISPLAY_XDISPLAY(display), keyval);
+    applemenu->hotkey_modifiers = modifiers & (ShiftMask | ControlMask | Mod1Mask | Mod3Mask | Mod4Mask | Mod5Mask);
+    if (applemenu->hotkey_keycode == 0)
+        return;
+    
+    root = gdk_screen_get_root_window(gtk_widget_get_screen(applemenu->button));
+    
+    gdk_x11_display_error_trap_push(display);
+    for (i = 0; i < G_N_ELEMENTS(applemenu_hotkey_ignored_modifiers); i++) {
+        XGrabKey(GDK_DISPLAY_XDISPLAY(display), applemenu->hotkey_keycode,
+                 applemenu->hotkey_modifiers | applemenu_hotkey_ignored_modifiers[i],
+                 GDK_WINDOW_XID(root), False, GrabModeAsync, GrabModeAsync);
+    }
+    if (gdk_x11_display_error_trap_pop(display) != 0)
+        g_warning("Shortcut \"%s\" is already taken", applemenu->popup_shortcut);
+    
+    gdk_window_add_filter(root, applemenu_hotkey_filter, applemenu);
+#else
+    (void)applemenu;
+#endif
+}
+
+static void
+applemenu_hotkey_ungrab(AppleMenuPlugin *applemenu)
+{
+#ifdef HAVE_X11
+    GdkDisplay *display = gdk_display_get_default();
+    GdkWindow *root;
+    guint i;
+    
+    if (applemenu->hotkey_keycode == 0)
+        return;
+    
+    root = gdk_screen_get_root_window(gtk_widget_get_screen(applemenu->button));
+    gdk_window_remove_filter(root, applemenu_hotkey_filter, applemenu);
+    
+    gdk_x11_display_error_trap_push(display);
+    for (i = 0; i < G_N_ELEMENTS(applemenu_hotkey_ignored_modifiers); i++) {
+        XUngrabKey(GDK_DISPLAY_XDISPLAY(display), applemenu->hotkey_keycode,
+                   applemenu->hotkey_modifiers | applemenu_hotkey_ignored_modifiers[i],
+                   GDK_WINDOW_XID(root));
+    }
+    gdk_x11_display_error_trap_pop_ignored(display);
+    
+    if (applemenu->hotkey_popup_id != 0) {
+        g_source_remove(applemenu->hotkey_popup_id);
+        applemenu->hotkey_popup_id = 0;
+    }
+    
+    applemenu->hotkey_keycode = 0;
+    applemenu->hotkey_pressed = FALSE;
+#else
+    (void)applemenu;
+#endif
+}
+
+/* Position of a built-in item in the default order */
+static gint
+applemenu_builtin_position(const gchar *id)
+{
+    guint i;
+    
+    for (i = 0; i < G_N_ELEMENTS(applemenu_builtin_items); i++) {
+        if (g_strcmp0(applemenu_builtin_items[i].id, id) == 0)
+            return i * APPLEMENU_POSITION_STEP;
+    }
+    
+    return G_MAXINT;
+}
+
+/* Apply hide/position settings from the rc file */
+static void
+applemenu_entry_apply_override(AppleMenuPlugin *applemenu, AppleMenuEntry *entry)
+{
+    AppleMenuItemOverride *override;
+    
+    override = g_hash_table_lookup(applemenu->item_overrides, entry->id);
+    if (override == NULL)
+        return;
+    
+    if (override->hidden)
+        entry->hidden = TRUE;
+    if (override->has_position)
+        entry->position = override->position;
+}
+
+static gint
+applemenu_entry_compare(gconstpointer a, gconstpointer b)
+{
+    const AppleMenuEntry *entry_a = a;
+    const AppleMenuEntry *entry_b = b;
+    
+    if (entry_a->position != entry_b->position)
+        return entry_a->position < entry_b->position ? -1 : 1;
+    
+    return g_strcmp0(entry_a->id, entry_b->id);
+}
+
+static void
+applemenu_entry_free(gpointer data)
+{
+    AppleMenuEntry *entry = (AppleMenuEntry *)data;
+    
+    if (entry->widget)
+        gtk_widget_destroy(entry->widget);
+    if (entry->app_info)
+        g_object_unref(entry->app_info);
+    g_free(entry->id);
+    g_slice_free(AppleMenuEntry, entry);
+}
+
+/* Menu id of the drop-in at path, NULL if it is not a .desktop file */
+static gchar *
+applemenu_dropin_id(const gchar *path)
+{
+    gchar *basename, *id;
+    
+    if (!g_str_has_suffix(path, ".desktop"))
+        return NULL;
+    
+    basename = g_path_get_basename(path);
+    basename[strlen(basename) - strlen(".desktop")] = '\0';
+    id = g_strconcat("custom-", basename, NULL);
+    g_free(basename);
+    
+    return id;
+}
+
+/* Load a drop-in, returns NULL if the file is missing or invalid */
+static AppleMenuEntry *
+applemenu_entry_new_dropin(AppleMenuPlugin *applemenu, const gchar *path)
+{
+    AppleMenuEntry *entry;
+    GDesktopAppInfo *info;
+    gchar *id, *position;
+    
+    id = applemenu_dropin_id(path);
+    if (id == NULL)
+        return NULL;
+    
+    info = g_desktop_app_info_new_from_filename(path);
+    if (info == NULL) {
+        g_debug("Ignoring invalid menu drop-in %s", path);
+        g_free(id);
+        return NULL;
+    }
+    
+    entry = g_slice_new0(AppleMenuEntry);
+    entry->type = MENU_ITEM_CUSTOM;
+    entry->id = id;
+    entry->app_info = info;
+    
+    /* NoDisplay, Hidden and OnlyShowIn hide the row, X-AppleMenu-Position places it */
+    entry->hidden = !g_app_info_should_show(G_APP_INFO(info));
+    position = g_desktop_app_info_get_string(info, "X-AppleMenu-Position");
+    if (position != NULL)
+        entry->position = atoi(position);
+    else
+        entry->position = applemenu_builtin_position(APPLEMENU_CUSTOM_ANCHOR) + APPLEMENU_POSITION_STEP / 2;
+    g_free(position);
+    
+    applemenu_entry_apply_override(applemenu, entry);
+    
+    return entry;
+}
+
+static AppleMenuEntry *
+applemenu_entry_find(AppleMenuPlugin *applemenu, const gchar *id)
+{
+    GList *li;
+    
+    for (li = applemenu->entries; li != NULL; li = li->next) {
+        AppleMenuEntry *entry = li->data;
+        if (g_strcmp0(entry->id, id) == 0)
+            return entry;
+    }
+    
+    return NULL;
+}
+
+static gboolean
+applemenu_entry_is_visible(AppleMenuPlugin *applemenu, AppleMenuEntry *entry)
+{
+    if (entry->hidden)
+        return FALSE;
+    if (entry->type == MENU_ITEM_RECENT && !applemenu->show_recent_items)
+        return FALSE;
+    if (entry->type == MENU_ITEM_POWER_PROFILE && !applemenu_power_available(applemenu))
+        return FALSE;
+    
+    return TRUE;
+}
+
+/* Launch a drop-in item */
+static void
+applemenu_custom_item_activate(GtkMenuItem *item G_GNUC_UNUSED, gpointer data)
+{
+    AppleMenuEntry *entry = (AppleMenuEntry *)data;
+    GdkAppLaunchContext *context;
+    GError *error = NULL;
+    
+    context = gdk_display_get_app_launch_context(gdk_display_get_default());
+    if (!g_app_info_launch(G_APP_INFO(entry->app_info), NULL, G_APP_LAUNCH_CONTEXT(context), &error)) {
+        xfce_dialog_show_error(NULL, error, _("Failed to launch \"%s\""),
+                               g_app_info_get_display_name(G_APP_INFO(entry->app_info)));
+        g_error_free(error);
+    }
+    g_object_unref(context);
+}
+
+static GtkWidget *
+applemenu_entry_create_widget(AppleMenuPlugin *applemenu, AppleMenuEntry *entry)
+{
+    GtkWidget *item, *image = NULL;
+    GIcon *gicon;
+    gchar *label;
+    
+    switch (entry->type) {
+    case MENU_ITEM_SEPARATOR:
+        return gtk_separator_menu_item_new();
+    
+    case MENU_ITEM_CUSTOM:
+        item = gtk_image_menu_item_new_with_label(g_app_info_get_display_name(G_APP_INFO(entry->app_info)));
+        gicon = g_app_info_get_icon(G_APP_INFO(entry->app_info));
+        if (gicon != NULL)
+            image = gtk_image_new_from_gicon(gicon, GTK_ICON_SIZE_MENU);
+        g_signal_connect(G_OBJECT(item), "activate",
+                         G_CALLBACK(applemenu_custom_item_activate), entry);
+        break;
+    
+    case MENU_ITEM_POWER_PROFILE:
+        item = gtk_image_menu_item_new_with_mnemonic(_(entry->builtin->label));
+        gtk_menu_item_set_submenu(GTK_MENU_ITEM(item), gtk_menu_new());
+        applemenu_power_fill_submenu(applemenu, gtk_menu_item_get_submenu(GTK_MENU_ITEM(item)));
+        break;
+    
+    case MENU_ITEM_LOGOUT:
+        /* Show current username */
+        label = g_strdup_printf(_(entry->builtin->label), g_get_user_name());
+        item = gtk_image_menu_item_new_with_mnemonic(label);
+        g_free(label);
+        break;
+    
+    default:
+        item = gtk_image_menu_item_new_with_mnemonic(_(entry->builtin->label));
+        break;
+    }
+    
+    if (entry->builtin != NULL) {
+        image = gtk_image_new_from_icon_name(entry->builtin->icon_name, GTK_ICON_SIZE_MENU);
+        if (entry->builtin->activate != NULL)
+            g_signal_connect(G_OBJECT(item), "activate", entry->builtin->activate, applemenu);
+    }
+    
+    if (image != NULL)
+        gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
+    
+    /* Recent Items (TODO: Implement submenu) */
+    if (entry->type == MENU_ITEM_RECENT)
+        gtk_widget_set_sensitive(item, FALSE);
+    
+    return item;
+}
+
+/* Hide separators that would end up leading, trailing or doubled */
+static void
+applemenu_menu_update_separators(AppleMenuPlugin *applemenu)
+{
+    GList *children, *li;
+    GtkWidget *last_separator = NULL;
+    gboolean after_separator = TRUE;
+    
+    children = gtk_container_get_children(GTK_CONTAINER(applemenu->menu));
+    for (li = children; li != NULL; li = li->next) {
+        if (GTK_IS_SEPARATOR_MENU_ITEM(li->data)) {
+            gtk_widget_set_visible(GTK_WIDGET(li->data), !after_separator);
+            if (!after_separator)
+                last_separator = li->data;
+            after_separator = TRUE;
+        } else {
+            after_separator = FALSE;
+        }
+    }
+    g_list_free(children);
+    
+    if (after_separator && last_separator != NULL)
+        gtk_widget_hide(last_separator);
+}
+
+/* Create the row for entry at its sorted place in the menu */
+static void
+applemenu_entry_insert(AppleMenuPlugin *applemenu, AppleMenuEntry *entry)
+{
+    GList *li;
+    gint index = 0;
+    
+    if (applemenu->menu == NULL || !applemenu_entry_is_visible(applemenu, entry))
+        return;
+    
+    for (li = applemenu->entries; li != NULL && li->data != entry; li = li->next) {
+        if (((AppleMenuEntry *)li->data)->widget != NULL)
+            index++;
+    }
+    
+    /* Rows are named by item id, for CSS (#sleep) and the tests */
+    entry->widget = applemenu_entry_create_widget(applemenu, entry);
+    gtk_widget_set_name(entry->widget, entry->id);
+    g_signal_connect(G_OBJECT(entry->widget), "destroy",
+                     G_CALLBACK(gtk_widget_destroyed), &entry->widget);
+    gtk_menu_shell_insert(GTK_MENU_SHELL(applemenu->menu), entry->widget, index);
+    gtk_widget_show_all(entry->widget);
+}
+
+/* Add or drop the row for entry after its visibility changed */
+static void
+applemenu_entry_sync(AppleMenuPlugin *applemenu, AppleMenuEntry *entry)
+{
+    if (applemenu->menu == NULL)
+        return;
+    
+    if (applemenu_entry_is_visible(applemenu, entry)) {
+        if (entry->widget == NULL)
+            applemenu_entry_insert(applemenu, entry);
+    } else if (entry->widget != NULL) {
+        gtk_widget_destroy(entry->widget);
+    }
+    
+    applemenu_menu_update_separators(applemenu);
+    applemenu_menu_invalidate(applemenu);
+}
+
+/* Re-read one drop-in and patch only its row */
+static void
+applemenu_dropin_reload(AppleMenuPlugin *applemenu, GFile *file)
+{
+    AppleMenuEntry *entry;
+    gchar *path, *id;
+    
+    path = g_file_get_path(file);
+    id = applemenu_dropin_id(path);
+    if (id == NULL) {
+        g_free(path);
+        return;
+    }
+    
+    /* Drop the old row */
+    entry = applemenu_entry_find(applemenu, id);
+    if (entry != NULL) {
+        applemenu->entries = g_list_remove(applemenu->entries, entry);
+        applemenu_entry_free(entry);
+    }
+    
+    /* Add the new one if the file is still there */
+    entry = applemenu_entry_new_dropin(applemenu, path);
+    if (entry != NULL) {
+        applemenu->entries = g_list_insert_sorted(applemenu->entries, entry,
+                                                  applemenu_entry_compare);
+        applemenu_entry_insert(applemenu, entry);
+    }
+    
+    if (applemenu->menu) {
+        applemenu_menu_update_separators(applemenu);
+        applemenu_menu_invalidate(applemenu);
+    }
+    
+    g_free(path);
+    g_free(id);
+}
+
+static void
+applemenu_dropin_changed(GFileMonitor *monitor G_GNUC_UNUSED,
+                         GFile *file,
+                         GFile *other_file,
+                         GFileMonitorEvent event,
+                         gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    
+    switch (event) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        applemenu_dropin_reload(applemenu, file);
+        break;
+    
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        applemenu_dropin_reload(applemenu, file);
+        applemenu_dropin_reload(applemenu, other_file);
+        break;
+    
+    default:
+        break;
+    }
+}
+
+/* Collect built-in and drop-in items, and start watching the drop-in directory */
+static void
+applemenu_load_items(AppleMenuPlugin *applemenu)
+{
+    AppleMenuEntry *entry;
+    GFile *file;
+    GDir *dir;
+    const gchar *name;
+    gchar *path;
+    GError *error = NULL;
+    guint i;
+    
+    for (i = 0; i < G_N_ELEMENTS(applemenu_builtin_items); i++) {
+        entry = g_slice_new0(AppleMenuEntry);
+        entry->builtin = &applemenu_builtin_items[i];
+        entry->type = entry->builtin->type;
+        entry->id = g_strdup(entry->builtin->id);
+        entry->position = i * APPLEMENU_POSITION_STEP;
+        applemenu_entry_apply_override(applemenu, entry);
+        applemenu->entries = g_list_prepend(applemenu->entries, entry);
+    }
+    
+    applemenu->dropin_dir = xfce_resource_save_location(XFCE_RESOURCE_CONFIG, APPLEMENU_DROPIN_DIR, TRUE);
+    if (G_UNLIKELY(applemenu->dropin_dir == NULL)) {
+        applemenu->entries = g_list_sort(applemenu->entries, applemenu_entry_compare);
+        return;
+    }
+    
+    dir = g_dir_open(applemenu->dropin_dir, 0, NULL);
+    if (dir != NULL) {
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            path = g_build_filename(applemenu->dropin_dir, name, NULL);
+            entry = applemenu_entry_new_dropin(applemenu, path);
+            if (entry != NULL)
+                applemenu->entries = g_list_prepend(applemenu->entries, entry);
+            g_free(path);
+        }
+        g_dir_close(dir);
+    }
+    
+    applemenu->entries = g_list_sort(applemenu->entries, applemenu_entry_compare);
+    
+    /* Watch for drop-ins being added, removed or edited */
+    file = g_file_new_for_path(applemenu->dropin_dir);
+    applemenu->dropin_monitor = g_file_monitor_directory(file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    g_object_unref(file);
+    
+    if (applemenu->dropin_monitor == NULL) {
+        g_warning("Failed to watch %s: %s", applemenu->dropin_dir, error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    g_signal_connect(G_OBJECT(applemenu->dropin_monitor), "changed",
+                     G_CALLBACK(applemenu_dropin_changed), applemenu);
+}
+
+/* Create menu */
+static void
+applemenu_create_menu(AppleMenuPlugin *applemenu)
+{
+    GtkWidget *menu;
+    GList *li;
+    
+    /* Create menu */
+    menu = gtk_menu_new();
+    applemenu->menu = menu;
+    
+    /* Connect menu signals to track visibility and sync with button */
+    g_signal_connect(G_OBJECT(menu), "show", 
+                     G_CALLBACK(applemenu_on_menu_show), applemenu);
+    g_signal_connect(G_OBJECT(menu), "hide", 
+                     G_CALLBACK(applemenu_on_menu_hide), applemenu);
+    g_signal_connect(G_OBJECT(menu), "deactivate",
+                     G_CALLBACK(applemenu_on_menu_deactivate), applemenu);
+    g_signal_connect(G_OBJECT(menu), "style-updated",
+                     G_CALLBACK(applemenu_on_menu_style_updated), applemenu);
+    g_signal_connect(G_OBJECT(menu), "draw",
+                     G_CALLBACK(applemenu_on_menu_draw), applemenu);
+    g_signal_connect(G_OBJECT(menu), "popped-up",
+                     G_CALLBACK(applemenu_on_menu_popped_up), applemenu);
+    
+    /* Share the panel's screen and style */
+    gtk_menu_attach_to_widget(GTK_MENU(menu), applemenu->button, NULL);
+    
+    /* One row per visible entry, in sorted order */
+    for (li = applemenu->entries; li != NULL; li = li->next)
+        applemenu_entry_insert(applemenu, li->data);
+    
+    applemenu_menu_update_separators(applemenu);
+    
+    /* Apply transparency if set */
+    if (applemenu->transparency < 100) {
+        gtk_widget_set_opacity(GTK_WIDGET(menu), 
+                              applemenu->transparency / 100.0);
+    }
+    
+    applemenu_menu_invalidate(applemenu);
+}
+
+/* Size changed callback */
+static gboolean
+applemenu_size_changed(XfcePanelPlugin *plugin G_GNUC_UNUSED, guint size, AppleMenuPlugin *applemenu)
+{
+    GtkIconSize icon_size;
+    gint icon_width;
+    
+    /* Determine icon size based on panel size */
+    if (size <= 16)
+        icon_size = GTK_ICON_SIZE_MENU;
+    else if (size <= 22)
+        icon_size = GTK_ICON_SIZE_SMALL_TOOLBAR;
+    else if (size <= 24)
+        icon_size = GTK_ICON_SIZE_LARGE_TOOLBAR;
+    else if (size <= 32)
+        icon_size = GTK_ICON_SIZE_DND;
+    else
+        icon_size = GTK_ICON_SIZE_DIALOG;
+    
+    /* Update icon */
+    gtk_image_set_from_icon_name(GTK_IMAGE(applemenu->icon),
+                                 applemenu->use_apple_logo ? APPLEMENU_ICON_NAME : APPLEMENU_FALLBACK_ICON,
+                                 icon_size);
+    
+    /* Set button size */
+    gtk_widget_set_size_request(GTK_WIDGET(applemenu->button), size, size);
+    
+    return TRUE;
+}
+
+/* Orientation changed callback */
+static void
+applemenu_orientation_changed(XfcePanelPlugin *plugin G_GNUC_UNUSED, GtkOrientation orientation, AppleMenuPlugin *applemenu)
+{
+    /* Update button orientation if needed */
+    if (GTK_IS_ORIENTABLE(applemenu->button))
+        gtk_orientable_set_orientation(GTK_ORIENTABLE(applemenu->button), orientation);
+    
+    /* The menu opens on another side now */
+    applemenu_geometry_invalidate(applemenu);
+}
+
+/* Menu show callback */
+static void
+applemenu_on_menu_show(GtkWidget *menu G_GNUC_UNUSED, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    applemenu->menu_visible = TRUE;
+}
+
+/* Menu hide callback */
+static void
+applemenu_on_menu_hide(GtkWidget *menu G_GNUC_UNUSED, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    applemenu->menu_visible = FALSE;
+    gtk_widget_hide(menu);
+}
+
+/* Menu deactivate callback */
+static void
+applemenu_on_menu_deactivate(GtkWidget *menu G_GNUC_UNUSED, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    applemenu->menu_visible = FALSE;
+    gtk_widget_hide(menu);
+}
+
+/* Menu callbacks implementation */
+static void
+applemenu_about_computer(GtkMenuItem *item G_GNUC_UNUSED, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GtkWidget *dialog, *content, *label;
+    gchar *text;
+    struct utsname un;
+    
+    /* Get system information */
+    uname(&un);
+    
+    /* Create dialog */
+    dialog = gtk_dialog_new_with_buttons(_("About This Computer"),
+                                         NULL,
+                                         GTK_DIALOG_DESTROY_WITH_PARENT,
+                                         _("_Close"), GTK_RESPONSE_CLOSE,
+                                         NULL);
+    
+    gtk_window_set_default_size(GTK_WINDOW(dialog), 400, 300);
+    gtk_window_set_position(GTK_WINDOW(dialog), GTK_WIN_POS_CENTER);
+    
+    /* Create content */
+    content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+    gtk_container_set_border_width(GTK_CONTAINER(content), 10);
+    
+    /* System information */
+    text = g_strdup_printf("<b>%s</b>\n\n"
+                          "<b>Operating System:</b> %s\n"
+                          "<b>Kernel:</b> %s %s\n"
+                          "<b>Architecture:</b> %s\n"
+                          "<b>Hostname:</b> %s\n",
+                          _("System Information"),
+                          un.sysname, un.release, un.version,
+                          un.machine, un.nodename);
+    
+    label = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(label), text);
+    gtk_label_set_justify(GTK_LABEL(label), GTK_JUSTIFY_LEFT);
+    gtk_label_set_selectable(GTK_LABEL(label), TRUE);
+    gtk_box_pack_start(GTK_BOX(content), label, FALSE, FALSE, 0);
+    
+    g_free(text);
+    
+    /* Show dialog */
+    gtk_widget_show_all(dialog);
+    gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(dialog);
+}
+
+static void
+applemenu_system_preferences(GtkMenuItem *item G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED)
+{
+    /* Launch XFCE Settings Manager */
+    GError *error = NULL;
+    if (!g_spawn_command_line_async("xfce4-settings-manager", &error)) {
+        xfce_dialog_show_error(NULL, error, _("Failed to open System Preferences"));
+        g_error_free(error);
+    }
+}
+
+static void
+applemenu_app_store(GtkMenuItem *item G_GNUC_UNUSED, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GError *error = NULL;
+    
+    /* Launch configured app store command */
+    if (!g_spawn_command_line_async(applemenu->app_store_command, &error)) {
+        gchar *message = g_strdup_printf(_("Failed to open App Store (%s)"), applemenu->app_store_command);
+        xfce_dialog_show_error(NULL, error, "%s", message);
+        g_free(message);
+        g_error_free(error);
+    }
+}
+
+static void
+applemenu_force_quit(GtkMenuItem *item G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED)
+{
+    /* Launch xkill */
+    GError *error = NULL;
+    if (!g_spawn_command_line_async("xkill", &error)) {
+        xfce_dialog_show_error(NULL, error, _("Failed to launch Force Quit"));
+        g_error_free(error);
+    }
+}
+
+static void
+applemenu_locker_proxy_ready(GObject *source G_GNUC_UNUSED, GAsyncResult *res, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GDBusProxy *proxy;
+    GError *error = NULL;
+    gchar *owner;
+    guint index;
+    
+    proxy = g_dbus_proxy_new_for_bus_finish(res, &error);
+    if (proxy == NULL) {
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_error_free(error);
+            return;
+        }
+        
+        g_debug("Failed to create screen locker proxy: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    /* Find where this locker sits in the list */
+    for (index = 0; index < G_N_ELEMENTS(applemenu_lockers); index++) {
+        if (g_strcmp0(applemenu_lockers[index].bus_name, g_dbus_proxy_get_name(proxy)) == 0)
+            break;
+    }
+    
+    /* Lockers are not activated by the probe, no owner means not running */
+    owner = g_dbus_proxy_get_name_owner(proxy);
+    if (owner == NULL) {
+        g_object_unref(proxy);
+        applemenu_locker_discover(applemenu, index + 1);
+        return;
+    }
+    
+    g_debug("Using screen locker %s (%s)", applemenu_lockers[index].bus_name, owner);
+    g_free(owner);
+    
+    if (applemenu->locker_proxy)
+        g_object_unref(applemenu->locker_proxy);
+    applemenu->locker_proxy = proxy;
+}
+
+/* Probe the lockers in order of preference, keeping the first one that runs */
+static void
+applemenu_locker_discover(AppleMenuPlugin *applemenu, guint index)
+{
+    if (index >= G_N_ELEMENTS(applemenu_lockers)) {
+        g_debug("No screen locker on the session bus, locking through xflock4");
+        return;
+    }
+    
+    /* Only look for a locker that already runs, never start one */
+    g_dbus_proxy_new_for_bus(G_BUS_TYPE_SESSION,
+                             G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                             G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS |
+                             G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START_AT_CONSTRUCTION,
+                             NULL,
+                             applemenu_lockers[index].bus_name,
+                             applemenu_lockers[index].object_path,
+                             applemenu_lockers[index].interface,
+                             applemenu->cancellable,
+                             applemenu_locker_proxy_ready, applemenu);
+}
+
+static void
+applemenu_lock_spawn(AppleMenuPlugin *applemenu)
+{
+    /* Lock screen */
+    GError *error = NULL;
+    if (!g_spawn_command_line_async("xflock4", &error)) {
+        xfce_dialog_show_error(NULL, error, _("Failed to lock screen"));
+        g_error_free(error);
+        return;
+    }
+    
+    g_debug("Spawned xflock4 %.1f ms after click",
+            (g_get_monotonic_time() - applemenu->lock_start_time) / 1000.0);
+}
+
+static void
+applemenu_lock_cb(GObject *source, GAsyncResult *res, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GDBusProxy *proxy = G_DBUS_PROXY(source);
+    GVariant *result;
+    GError *error = NULL;
+    
+    result = g_dbus_proxy_call_finish(proxy, res, &error);
+    if (result == NULL) {
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_error_free(error);
+            return;
+        }
+        
+        /* Locker went away, fall back and look for another one */
+        g_warning("Screen locker %s failed: %s", g_dbus_proxy_get_name(proxy), error->message);
+        g_error_free(error);
+        
+        if (applemenu->locker_proxy == proxy) {
+            g_object_unref(applemenu->locker_proxy);
+            applemenu->locker_proxy = NULL;
+            applemenu_locker_discover(applemenu, 0);
+        }
+        
+        /* xflock4 returns before the screen is locked, a pending suspend
+         * keeps waiting for ActiveChanged or the timeout */
+        applemenu_lock_spawn(applemenu);
+        return;
+    }
+    
+    g_debug("Screen locked through %s in %.1f ms",
+            g_dbus_proxy_get_name(proxy),
+            (g_get_monotonic_time() - applemenu->lock_start_time) / 1000.0);
+    g_variant_unref(result);
+    
+    if (applemenu->sleep_timeout_id != 0)
+        applemenu_sleep_locked(applemenu);
+}
+
+/* Lock with a single call on the pre-connected locker */
+static void
+applemenu_lock(AppleMenuPlugin *applemenu)
+{
+    applemenu->lock_start_time = g_get_monotonic_time();
+    
+    /* Only a Lock reply over D-Bus means locked, see applemenu_lock_cb */
+    if (applemenu->locker_proxy == NULL) {
+        applemenu_lock_spawn(applemenu);
+        return;
+    }
+    
+    g_dbus_proxy_call(applemenu->locker_proxy,
+                      "Lock",
+                      NULL,
+                      G_DBUS_CALL_FLAGS_NONE,
+                      -1,
+                      applemenu->cancellable,
+                      applemenu_lock_cb, applemenu);
+}
+
+static const gchar *
+applemenu_power_profile_label(const gchar *profile)
+{
+    if (g_strcmp0(profile, "power-saver") == 0)
+        return _("Power Saver");
+    if (g_strcmp0(profile, "balanced") == 0)
+        return _("Balanced");
+    if (g_strcmp0(profile, "performance") == 0)
+        return _("Performance");
+    
+    return profile;
+}
+
+static const gchar *
+applemenu_power_degraded_label(const gchar *reason)
+{
+    if (g_strcmp0(reason, "lap-detected") == 0)
+        return _("Performance limited: computer is on a lap");
+    if (g_strcmp0(reason, "high-operating-temperature") == 0)
+        return _("Performance limited: high temperature");
+    
+    return _("Performance limited");
+}
+
+static gboolean
+applemenu_power_available(AppleMenuPlugin *applemenu)
+{
+    gboolean available;
+    gchar *owner;
+    
+    if (applemenu->power_proxy == NULL)
+        return FALSE;
+    
+    owner = g_dbus_proxy_get_name_owner(applemenu->power_proxy);
+    available = owner != NULL;
+    g_free(owner);
+    
+    return available;
+}
+
+static void
+applemenu_power_set_cb(GObject *source, GAsyncResult *res, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    AppleMenuEntry *entry;
+    GVariant *result;
+    GError *error = NULL;
+    
+    result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
+    if (result != NULL) {
+        g_variant_unref(result);
+        return;
+    }
+    
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+    
+    g_warning("Failed to switch power profile: %s", error->message);
+    g_error_free(error);
+    
+    /* Put the radio items back on the active profile */
+    entry = applemenu_entry_find(applemenu, "power-profile");
+    if (entry != NULL && entry->widget != NULL)
+        applemenu_power_fill_submenu(applemenu, gtk_menu_item_get_submenu(GTK_MENU_ITEM(entry->widget)));
+}
+
+static void
+applemenu_power_profile_toggled(GtkCheckMenuItem *item, AppleMenuPlugin *applemenu)
+{
+    const gchar *profile;
+    
+    if (applemenu->power_updating || !gtk_check_menu_item_get_active(item))
+        return;
+    
+    profile = g_object_get_data(G_OBJECT(item), "power-profile");
+    g_dbus_proxy_call(applemenu->power_proxy,
+                      "org.freedesktop.DBus.Properties.Set",
+                      g_variant_new("(ssv)", POWER_PROFILES_IFACE, "ActiveProfile",
+                                    g_variant_new_string(profile)),
+                      G_DBUS_CALL_FLAGS_NONE,
+                      -1,
+                      applemenu->cancellable,
+                      applemenu_power_set_cb, applemenu);
+}
+
+/* Rebuild the radio items from the cached Profiles, ActiveProfile and
+ * PerformanceDegraded properties */
+static void
+applemenu_power_fill_submenu(AppleMenuPlugin *applemenu, GtkWidget *submenu)
+{
+    GVariant *profiles, *active, *degraded, *dict;
+    GVariantIter iter;
+    GSList *group = NULL;
+    GtkWidget *item;
+    GList *children;
+    const gchar *active_profile = NULL;
+    const gchar *profile;
+    
+    children = gtk_container_get_children(GTK_CONTAINER(submenu));
+    g_list_free_full(children, (GDestroyNotify)gtk_widget_destroy);
+    
+    if (applemenu->power_proxy == NULL)
+        return;
     
-    /* About This Computer */
-    item = gtk_image_menu_item_new_with_mnemonic(_("_About This Computer"));
-    image = gtk_image_new_from_icon_name("computer", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_about_computer), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Separator */
-    item = gtk_separator_menu_item_new();
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* System Preferences */
-    item = gtk_image_menu_item_new_with_mnemonic(_("System _Preferences..."));
-    image = gtk_image_new_from_icon_name("preferences-system", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_system_preferences), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* App Store (Pamac) */
-    item = gtk_image_menu_item_new_with_mnemonic(_("_App Store..."));
-    image = gtk_image_new_from_icon_name("system-software-install", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_app_store), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Separator */
-    item = gtk_separator_menu_item_new();
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
+    profiles = g_dbus_proxy_get_cached_property(applemenu->power_proxy, "Profiles");
+    active = g_dbus_proxy_get_cached_property(applemenu->power_proxy, "ActiveProfile");
+    degraded = g_dbus_proxy_get_cached_property(applemenu->power_proxy, "PerformanceDegraded");
+    
+    if (active != NULL)
+        active_profile = g_variant_get_string(active, NULL);
+    
+    applemenu->power_updating = TRUE;
+    
+    if (profiles != NULL && g_variant_is_of_type(profiles, G_VARIANT_TYPE("aa{sv}"))) {
+        g_variant_iter_init(&iter, profiles);
+        while ((dict = g_variant_iter_next_value(&iter)) != NULL) {
+            if (g_variant_lookup(dict, "Profile", "&s", &profile)) {
+                item = gtk_radio_menu_item_new_with_label(group, applemenu_power_profile_label(profile));
+                group = gtk_radio_menu_item_get_group(GTK_RADIO_MENU_ITEM(item));
+                g_object_set_data_full(G_OBJECT(item), "power-profile", g_strdup(profile), g_free);
+                gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item),
+                                               g_strcmp0(profile, active_profile) == 0);
+                g_signal_connect(G_OBJECT(item), "toggled",
+                                 G_CALLBACK(applemenu_power_profile_toggled), applemenu);
+                gtk_menu_shell_append(GTK_MENU_SHELL(submenu), item);
+                gtk_widget_show(item);
+            }
+            g_variant_unref(dict);
+        }
+    }
     
-    /* Recent Items (TODO: Implement submenu) */
-    if (applemenu->show_recent_items) {
-        item = gtk_image_menu_item_new_with_mnemonic(_("Recent _Items"));
-        image = gtk_image_new_from_icon_name("document-open-recent", GTK_ICON_SIZE_MENU);
-        gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-        gtk_widget_set_sensitive(item, FALSE); /* Disabled for now */
-        gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+    applemenu->power_updating = FALSE;
+    
+    /* Tell why performance is held back, if it is */
+    if (degraded != NULL && *g_variant_get_string(degraded, NULL) != '\0') {
+        item = gtk_separator_menu_item_new();
+        gtk_menu_shell_append(GTK_MENU_SHELL(submenu), item);
         gtk_widget_show(item);
         
-        /* Separator */
-        item = gtk_separator_menu_item_new();
-        gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+        item = gtk_menu_item_new_with_label(applemenu_power_degraded_label(g_variant_get_string(degraded, NULL)));
+        gtk_widget_set_sensitive(item, FALSE);
+        gtk_menu_shell_append(GTK_MENU_SHELL(submenu), item);
         gtk_widget_show(item);
     }
     
-    /* Force Quit */
-    item = gtk_image_menu_item_new_with_mnemonic(_("_Force Quit..."));
-    image = gtk_image_new_from_icon_name("process-stop", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_force_quit), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Separator */
-    item = gtk_separator_menu_item_new();
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Sleep */
-    item = gtk_image_menu_item_new_with_mnemonic(_("_Sleep"));
-    image = gtk_image_new_from_icon_name("system-suspend", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_sleep), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Restart */
-    item = gtk_image_menu_item_new_with_mnemonic(_("_Restart..."));
-    image = gtk_image_new_from_icon_name("system-reboot", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_restart), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Shut Down */
-    item = gtk_image_menu_item_new_with_mnemonic(_("Shut _Down..."));
-    image = gtk_image_new_from_icon_name("system-shutdown", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_shutdown), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Separator */
-    item = gtk_separator_menu_item_new();
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Lock Screen */
-    item = gtk_image_menu_item_new_with_mnemonic(_("_Lock Screen"));
-    image = gtk_image_new_from_icon_name("system-lock-screen", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_lock_screen), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Log Out - Show current username */
-    const gchar *username = g_get_user_name();
-    gchar *logout_label = g_strdup_printf(_("Log Out %s..."), username);
-    item = gtk_image_menu_item_new_with_mnemonic(logout_label);
-    g_free(logout_label);
-    image = gtk_image_new_from_icon_name("system-log-out", GTK_ICON_SIZE_MENU);
-    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
-    g_signal_connect(G_OBJECT(item), "activate",
-                     G_CALLBACK(applemenu_logout), applemenu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-    gtk_widget_show(item);
-    
-    /* Apply transparency if set */
-    if (applemenu->transparency < 100) {
-        gtk_widget_set_opacity(GTK_WIDGET(menu), 
-                              applemenu->transparency / 100.0);
-    }
-    
-    gtk_widget_show_all(menu);
+    if (profiles != NULL)
+        g_variant_unref(profiles);
+    if (active != NULL)
+        g_variant_unref(active);
+    if (degraded != NULL)
+        g_variant_unref(degraded);
 }
 
-/* Size changed callback */
-static gboolean
-applemenu_size_changed(XfcePanelPlugin *plugin G_GNUC_UNUSED, guint size, AppleMenuPlugin *applemenu)
+/* Properties changed, or the daemon appeared or went away */
+static void
+applemenu_power_refresh(AppleMenuPlugin *applemenu)
 {
-    GtkIconSize icon_size;
-    gint icon_width;
+    AppleMenuEntry *entry;
+    gboolean visible;
     
-    /* Determine icon size based on panel size */
-    if (size <= 16)
-        icon_size = GTK_ICON_SIZE_MENU;
-    else if (size <= 22)
-        icon_size = GTK_ICON_SIZE_SMALL_TOOLBAR;
-    else if (size <= 24)
-        icon_size = GTK_ICON_SIZE_LARGE_TOOLBAR;
-    else if (size <= 32)
-        icon_size = GTK_ICON_SIZE_DND;
-    else
-        icon_size = GTK_ICON_SIZE_DIALOG;
+    entry = applemenu_entry_find(applemenu, "power-profile");
+    if (entry == NULL)
+        return;
     
-    /* Update icon */
-    gtk_image_set_from_icon_name(GTK_IMAGE(applemenu->icon),
-                                 applemenu->use_apple_logo ? APPLEMENU_ICON_NAME : APPLEMENU_FALLBACK_ICON,
-                                 icon_size);
+    visible = applemenu_entry_is_visible(applemenu, entry);
     
-    /* Set button size */
-    gtk_widget_set_size_request(GTK_WIDGET(applemenu->button), size, size);
+    /* Only the submenu changes, the menu keeps its measurements and placement */
+    if (entry->widget != NULL && visible) {
+        applemenu_power_fill_submenu(applemenu, gtk_menu_item_get_submenu(GTK_MENU_ITEM(entry->widget)));
+        return;
+    }
     
-    return TRUE;
+    /* Add or drop the row, a new row is filled when it is created */
+    if ((entry->widget != NULL) != visible)
+        applemenu_entry_sync(applemenu, entry);
 }
 
-/* Orientation changed callback */
 static void
-applemenu_orientation_changed(XfcePanelPlugin *plugin G_GNUC_UNUSED, GtkOrientation orientation, AppleMenuPlugin *applemenu)
+applemenu_power_properties_changed(GDBusProxy *proxy G_GNUC_UNUSED,
+                                   GVariant *changed G_GNUC_UNUSED,
+                                   GStrv invalidated G_GNUC_UNUSED,
+                                   AppleMenuPlugin *applemenu)
 {
-    /* Update button orientation if needed */
-    gtk_orientable_set_orientation(GTK_ORIENTABLE(applemenu->button), orientation);
+    applemenu_power_refresh(applemenu);
 }
 
-/* Menu show callback */
 static void
-applemenu_on_menu_show(GtkWidget *menu G_GNUC_UNUSED, gpointer data)
+applemenu_power_proxy_ready(GObject *source G_GNUC_UNUSED, GAsyncResult *res, gpointer data)
 {
     AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
-    applemenu->menu_visible = TRUE;
+    GDBusProxy *proxy;
+    GError *error = NULL;
+    
+    proxy = g_dbus_proxy_new_for_bus_finish(res, &error);
+    if (proxy == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_debug("power-profiles-daemon not available: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    applemenu->power_proxy = proxy;
+    
+    /* ActiveProfile and PerformanceDegraded arrive through PropertiesChanged */
+    g_signal_connect(G_OBJECT(proxy), "g-properties-changed",
+                     G_CALLBACK(applemenu_power_properties_changed), applemenu);
+    g_signal_connect_swapped(G_OBJECT(proxy), "notify::g-name-owner",
+                             G_CALLBACK(applemenu_power_refresh), applemenu);
+    
+    applemenu_power_refresh(applemenu);
 }
 
-/* Menu hide callback */
 static void
-applemenu_on_menu_hide(GtkWidget *menu G_GNUC_UNUSED, gpointer data)
+applemenu_power_connect(AppleMenuPlugin *applemenu)
 {
-    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
-    applemenu->menu_visible = FALSE;
-    gtk_widget_hide(menu);
+    g_dbus_proxy_new_for_bus(G_BUS_TYPE_SYSTEM,
+                             G_DBUS_PROXY_FLAGS_NONE,
+                             NULL,
+                             POWER_PROFILES_BUS_NAME,
+                             POWER_PROFILES_OBJECT_PATH,
+                             POWER_PROFILES_IFACE,
+                             applemenu->cancellable,
+                             applemenu_power_proxy_ready, applemenu);
 }
 
-/* Menu deactivate callback */
 static void
-applemenu_on_menu_deactivate(GtkWidget *menu G_GNUC_UNUSED, gpointer data)
+applemenu_sleep_spawn(void)
 {
-    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
-    applemenu->menu_visible = FALSE;
-    gtk_widget_hide(menu);
+    /* Suspend system */
+    GError *error = NULL;
+    if (!g_spawn_command_line_async("xfce4-session-logout --suspend", &error)) {
+        xfce_dialog_show_error(NULL, error, _("Failed to suspend system"));
+        g_error_free(error);
+    }
 }
 
-/* Menu callbacks implementation */
+/* Drop the ActiveChanged watches of the pending suspend */
 static void
-applemenu_about_computer(GtkMenuItem *item G_GNUC_UNUSED, gpointer data)
+applemenu_sleep_unwatch(AppleMenuPlugin *applemenu)
 {
-    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
-    GtkWidget *dialog, *content, *label;
-    gchar *text;
-    struct utsname un;
+    guint i;
     
-    /* Get system information */
-    uname(&un);
+    if (applemenu->sleep_session_bus == NULL)
+        return;
     
-    /* Create dialog */
-    dialog = gtk_dialog_new_with_buttons(_("About This Computer"),
-                                         NULL,
-                                         GTK_DIALOG_DESTROY_WITH_PARENT,
-                                         _("_Close"), GTK_RESPONSE_CLOSE,
-                                         NULL);
+    for (i = 0; i < G_N_ELEMENTS(applemenu->sleep_active_ids); i++) {
+        if (applemenu->sleep_active_ids[i] != 0) {
+            g_dbus_connection_signal_unsubscribe(applemenu->sleep_session_bus,
+                                                 applemenu->sleep_active_ids[i]);
+            applemenu->sleep_active_ids[i] = 0;
+        }
+    }
     
-    gtk_window_set_default_size(GTK_WINDOW(dialog), 400, 300);
-    gtk_window_set_position(GTK_WINDOW(dialog), GTK_WIN_POS_CENTER);
+    g_object_unref(applemenu->sleep_session_bus);
+    applemenu->sleep_session_bus = NULL;
+}
+
+/* Drop the delay inhibitor so logind can go ahead with the suspend */
+static void
+applemenu_sleep_release_inhibitor(AppleMenuPlugin *applemenu)
+{
+    if (applemenu->sleep_timeout_id != 0) {
+        g_source_remove(applemenu->sleep_timeout_id);
+        applemenu->sleep_timeout_id = 0;
+    }
     
-    /* Create content */
-    content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-    gtk_container_set_border_width(GTK_CONTAINER(content), 10);
+    /* Stop waiting for the locker */
+    applemenu_sleep_unwatch(applemenu);
     
-    /* System information */
-    text = g_strdup_printf("<b>%s</b>\n\n"
-                          "<b>Operating System:</b> %s\n"
-                          "<b>Kernel:</b> %s %s\n"
-                          "<b>Architecture:</b> %s\n"
-                          "<b>Hostname:</b> %s\n",
-                          _("System Information"),
-                          un.sysname, un.release, un.version,
-                          un.machine, un.nodename);
+    if (applemenu->sleep_inhibit_fd >= 0) {
+        close(applemenu->sleep_inhibit_fd);
+        applemenu->sleep_inhibit_fd = -1;
+        g_debug("Released sleep inhibitor %.1f ms after click",
+                (g_get_monotonic_time() - applemenu->sleep_start_time) / 1000.0);
+    }
+}
+
+/* Locker never answered, do not keep the system awake any longer */
+static gboolean
+applemenu_sleep_timeout(gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
     
-    label = gtk_label_new(NULL);
-    gtk_label_set_markup(GTK_LABEL(label), text);
-    gtk_label_set_justify(GTK_LABEL(label), GTK_JUSTIFY_LEFT);
-    gtk_label_set_selectable(GTK_LABEL(label), TRUE);
-    gtk_box_pack_start(GTK_BOX(content), label, FALSE, FALSE, 0);
+    g_warning("Screen locker did not confirm within %d ms, suspending anyway",
+              APPLEMENU_SLEEP_LOCK_TIMEOUT);
     
-    g_free(text);
+    applemenu->sleep_timeout_id = 0;
+    applemenu->sleep_locked = TRUE;
+    applemenu_sleep_release_inhibitor(applemenu);
     
-    /* Show dialog */
-    gtk_widget_show_all(dialog);
-    gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_destroy(dialog);
+    return G_SOURCE_REMOVE;
 }
 
 static void
-applemenu_system_preferences(GtkMenuItem *item G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED)
+applemenu_sleep_inhibit_cb(GObject *source, GAsyncResult *res, gpointer data)
 {
-    /* Launch XFCE Settings Manager */
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GUnixFDList *fd_list = NULL;
+    GVariant *result;
     GError *error = NULL;
-    if (!g_spawn_command_line_async("xfce4-settings-manager", &error)) {
-        xfce_dialog_show_error(NULL, error, _("Failed to open System Preferences"));
+    gint32 index;
+    gint fd;
+    
+    result = g_dbus_connection_call_with_unix_fd_list_finish(G_DBUS_CONNECTION(source),
+                                                             &fd_list, res, &error);
+    if (result == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning("Failed to take sleep inhibitor: %s", error->message);
         g_error_free(error);
+        return;
+    }
+    
+    g_variant_get(result, "(h)", &index);
+    fd = g_unix_fd_list_get(fd_list, index, &error);
+    g_variant_unref(result);
+    g_object_unref(fd_list);
+    
+    if (fd < 0) {
+        g_warning("Failed to take sleep inhibitor: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    /* The locker may have answered before logind did */
+    if (applemenu->sleep_locked || applemenu->sleep_timeout_id == 0) {
+        close(fd);
+        return;
     }
+    
+    applemenu->sleep_inhibit_fd = fd;
 }
 
 static void
-applemenu_app_store(GtkMenuItem *item G_GNUC_UNUSED, gpointer data)
+applemenu_sleep_suspend_cb(GObject *source, GAsyncResult *res, gpointer data)
 {
     AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GVariant *result;
     GError *error = NULL;
     
-    /* Launch configured app store command */
-    if (!g_spawn_command_line_async(applemenu->app_store_command, &error)) {
-        gchar *message = g_strdup_printf(_("Failed to open App Store (%s)"), applemenu->app_store_command);
-        xfce_dialog_show_error(NULL, error, "%s", message);
-        g_free(message);
+    result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL) {
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_error_free(error);
+            return;
+        }
+        
+        /* logind refused, release and let the session manager try */
+        g_warning("Failed to suspend through logind: %s", error->message);
         g_error_free(error);
+        applemenu->sleep_locked = TRUE;
+        applemenu_sleep_release_inhibitor(applemenu);
+        applemenu_sleep_spawn();
+        return;
     }
+    
+    g_variant_unref(result);
 }
 
 static void
-applemenu_force_quit(GtkMenuItem *item G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED)
+applemenu_sleep_got_system_bus(GObject *source G_GNUC_UNUSED, GAsyncResult *res, gpointer data)
 {
-    /* Launch xkill */
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GDBusConnection *connection;
     GError *error = NULL;
-    if (!g_spawn_command_line_async("xkill", &error)) {
-        xfce_dialog_show_error(NULL, error, _("Failed to launch Force Quit"));
+    
+    connection = g_bus_get_finish(res, &error);
+    if (connection == NULL) {
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_error_free(error);
+            return;
+        }
+        
+        g_warning("Failed to connect to the system bus: %s", error->message);
         g_error_free(error);
+        applemenu->sleep_locked = TRUE;
+        applemenu_sleep_release_inhibitor(applemenu);
+        applemenu_sleep_spawn();
+        return;
     }
+    
+    /* Both calls go out back to back on the same connection, so logind
+     * registers the delay inhibitor before it handles the suspend request */
+    g_dbus_connection_call_with_unix_fd_list(connection,
+                                             LOGIND_BUS_NAME,
+                                             LOGIND_OBJECT_PATH,
+                                             LOGIND_MANAGER_IFACE,
+                                             "Inhibit",
+                                             g_variant_new("(ssss)", "sleep",
+                                                           _("Apple Menu"),
+                                                           _("Locking the screen before sleep"),
+                                                           "delay"),
+                                             G_VARIANT_TYPE("(h)"),
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             -1, NULL,
+                                             applemenu->cancellable,
+                                             applemenu_sleep_inhibit_cb, applemenu);
+    
+    g_dbus_connection_call(connection,
+                           LOGIND_BUS_NAME,
+                           LOGIND_OBJECT_PATH,
+                           LOGIND_MANAGER_IFACE,
+                           "Suspend",
+                           g_variant_new("(b)", TRUE),
+                           NULL,
+                           G_DBUS_CALL_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION,
+                           -1,
+                           applemenu->cancellable,
+                           applemenu_sleep_suspend_cb, applemenu);
+    
+    g_object_unref(connection);
 }
 
+/* The locker is up, the suspend can proceed */
 static void
-applemenu_sleep(GtkMenuItem *item G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED)
+applemenu_sleep_locked(AppleMenuPlugin *applemenu)
 {
-    /* Suspend system */
+    applemenu->sleep_locked = TRUE;
+    applemenu_sleep_release_inhibitor(applemenu);
+}
+
+/* A known session locker turning active, including one xflock4 started */
+static void
+applemenu_sleep_active_changed(GDBusConnection *connection G_GNUC_UNUSED,
+                               const gchar *sender G_GNUC_UNUSED,
+                               const gchar *object_path G_GNUC_UNUSED,
+                               const gchar *interface,
+                               const gchar *signal G_GNUC_UNUSED,
+                               GVariant *parameters,
+                               gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    gboolean active = FALSE;
+    
+    if (g_variant_is_of_type(parameters, G_VARIANT_TYPE("(b)")))
+        g_variant_get(parameters, "(b)", &active);
+    
+    if (!active || applemenu->sleep_timeout_id == 0)
+        return;
+    
+    g_debug("%s reported the screen locked %.1f ms after click", interface,
+            (g_get_monotonic_time() - applemenu->sleep_start_time) / 1000.0);
+    applemenu_sleep_locked(applemenu);
+}
+
+/* Watch ActiveChanged of the lockers in applemenu_lockers[] only, so other
+ * services on the session bus cannot release the inhibitor */
+static void
+applemenu_sleep_watch(AppleMenuPlugin *applemenu, GDBusConnection *connection)
+{
+    guint i;
+    
+    applemenu->sleep_session_bus = g_object_ref(connection);
+    for (i = 0; i < G_N_ELEMENTS(applemenu_lockers); i++) {
+        applemenu->sleep_active_ids[i] =
+            g_dbus_connection_signal_subscribe(connection,
+                                               NULL,
+                                               applemenu_lockers[i].interface,
+                                               "ActiveChanged",
+                                               applemenu_lockers[i].object_path,
+                                               NULL,
+                                               G_DBUS_SIGNAL_FLAGS_NONE,
+                                               applemenu_sleep_active_changed,
+                                               applemenu, NULL);
+    }
+}
+
+static void
+applemenu_sleep_got_session_bus(GObject *source G_GNUC_UNUSED, GAsyncResult *res, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    GDBusConnection *connection;
     GError *error = NULL;
-    if (!g_spawn_command_line_async("xfce4-session-logout --suspend", &error)) {
-        xfce_dialog_show_error(NULL, error, _("Failed to suspend system"));
+    
+    connection = g_bus_get_finish(res, &error);
+    if (connection == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning("Failed to connect to the session bus: %s", error->message);
         g_error_free(error);
+        return;
+    }
+    
+    /* Only while the suspend is still waiting for the locker */
+    if (applemenu->sleep_timeout_id != 0 && applemenu->sleep_session_bus == NULL)
+        applemenu_sleep_watch(applemenu, connection);
+    
+    g_object_unref(connection);
+}
+
+static void
+applemenu_sleep(GtkMenuItem *item G_GNUC_UNUSED, gpointer data)
+{
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    
+    if (!applemenu->lock_on_sleep) {
+        applemenu_sleep_spawn();
+        return;
     }
+    
+    /* Suspend already in flight */
+    if (applemenu->sleep_timeout_id != 0)
+        return;
+    
+    applemenu->sleep_start_time = g_get_monotonic_time();
+    applemenu->sleep_locked = FALSE;
+    applemenu->sleep_timeout_id = g_timeout_add(APPLEMENU_SLEEP_LOCK_TIMEOUT,
+                                                applemenu_sleep_timeout, applemenu);
+    
+    /* Without a Lock reply, ActiveChanged from the locker is the other proof.
+     * The locker proxy already holds the session bus, otherwise get it
+     * without blocking the click */
+    if (applemenu->locker_proxy)
+        applemenu_sleep_watch(applemenu, g_dbus_proxy_get_connection(applemenu->locker_proxy));
+    else
+        g_bus_get(G_BUS_TYPE_SESSION, applemenu->cancellable,
+                  applemenu_sleep_got_session_bus, applemenu);
+    
+    /* Lock and suspend run in parallel, the delay inhibitor keeps logind
+     * from sleeping until the locker has confirmed */
+    g_bus_get(G_BUS_TYPE_SYSTEM, applemenu->cancellable,
+              applemenu_sleep_got_system_bus, applemenu);
+    applemenu_lock(applemenu);
 }
 
 static void
@@ -520,14 +2060,10 @@ applemenu_shutdown(GtkMenuItem *item G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED)
 }
 
 static void
-applemenu_lock_screen(GtkMenuItem *item G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED)
+applemenu_lock_screen(GtkMenuItem *item G_GNUC_UNUSED, gpointer data)
 {
-    /* Lock screen */
-    GError *error = NULL;
-    if (!g_spawn_command_line_async("xflock4", &error)) {
-        xfce_dialog_show_error(NULL, error, _("Failed to lock screen"));
-        g_error_free(error);
-    }
+    AppleMenuPlugin *applemenu = (AppleMenuPlugin *)data;
+    applemenu_lock(applemenu);
 }
 
 static void
@@ -545,8 +2081,10 @@ applemenu_logout(GtkMenuItem *item G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED)
 static void
 applemenu_load_config(AppleMenuPlugin *applemenu)
 {
-    gchar *file;
+    AppleMenuItemOverride *override;
+    gchar *file, **groups;
     XfceRc *rc;
+    guint i;
     
     /* Get config file location */
     file = xfce_panel_plugin_save_location(applemenu->plugin, TRUE);
@@ -571,6 +2109,26 @@ applemenu_load_config(AppleMenuPlugin *applemenu)
     applemenu->app_store_command = g_strdup(xfce_rc_read_entry(rc, "app-store-command", DEFAULT_APP_STORE_COMMAND));
     
     applemenu->transparency = xfce_rc_read_int_entry(rc, "transparency", DEFAULT_TRANSPARENCY);
+    applemenu->lock_on_sleep = xfce_rc_read_bool_entry(rc, "lock-on-sleep", DEFAULT_LOCK_ON_SLEEP);
+    
+    g_free(applemenu->popup_shortcut);
+    applemenu->popup_shortcut = g_strdup(xfce_rc_read_entry(rc, "popup-shortcut", DEFAULT_POPUP_SHORTCUT));
+    
+    /* Per-item settings */
+    groups = xfce_rc_get_groups(rc);
+    for (i = 0; groups != NULL && groups[i] != NULL; i++) {
+        if (!g_str_has_prefix(groups[i], "item-"))
+            continue;
+        
+        xfce_rc_set_group(rc, groups[i]);
+        override = g_new0(AppleMenuItemOverride, 1);
+        override->hidden = xfce_rc_read_bool_entry(rc, "hidden", FALSE);
+        override->has_position = xfce_rc_has_entry(rc, "position");
+        override->position = xfce_rc_read_int_entry(rc, "position", 0);
+        g_hash_table_replace(applemenu->item_overrides,
+                             g_strdup(groups[i] + strlen("item-")), override);
+    }
+    g_strfreev(groups);
     
     /* Close config file */
     xfce_rc_close(rc);
@@ -595,6 +2153,8 @@ applemenu_load_config(AppleMenuPlugin *applemenu)
 static void
 applemenu_save_config(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu)
 {
+    GHashTableIter iter;
+    gpointer key, value;
     gchar *file;
     XfceRc *rc;
     
@@ -616,6 +2176,21 @@ applemenu_save_config(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu)
     xfce_rc_write_entry(rc, "custom-icon-name", applemenu->custom_icon_name);
     xfce_rc_write_entry(rc, "app-store-command", applemenu->app_store_command);
     xfce_rc_write_int_entry(rc, "transparency", applemenu->transparency);
+    xfce_rc_write_bool_entry(rc, "lock-on-sleep", applemenu->lock_on_sleep);
+    xfce_rc_write_entry(rc, "popup-shortcut", applemenu->popup_shortcut);
+    
+    /* Per-item settings */
+    g_hash_table_iter_init(&iter, applemenu->item_overrides);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        AppleMenuItemOverride *override = value;
+        gchar *group = g_strconcat("item-", (const gchar *)key, NULL);
+        
+        xfce_rc_set_group(rc, group);
+        xfce_rc_write_bool_entry(rc, "hidden", override->hidden);
+        if (override->has_position)
+            xfce_rc_write_int_entry(rc, "position", override->position);
+        g_free(group);
+    }
     
     /* Close config file */
     xfce_rc_close(rc);
@@ -636,17 +2211,10 @@ applemenu_configure_response(GtkWidget *dialog, gint response, AppleMenuPlugin *
             g_warning(_("Unable to open the following url: %s"), 
                      "https://docs.xfce.org/xfce/xfce4-panel/start");
     } else {
-        /* Save configuration on close */
+        /* Save configuration on close, the menu already follows every change */
         applemenu_save_config(applemenu->plugin, applemenu);
         
-        /* Recreate menu with new settings */
-        if (applemenu->menu) {
-            gtk_widget_destroy(applemenu->menu);
-            applemenu->menu = NULL;
-        }
-        applemenu_create_menu(applemenu);
-        
-        /* Hide dialog instead of destroying to avoid issues */
+        /* Hide dialog, it is reused on the next open */
         gtk_widget_hide(dialog);
         
         /* Unblock panel menu */
@@ -704,6 +2272,57 @@ applemenu_transparency_changed(GtkScale *scale, AppleMenuPlugin *applemenu)
     }
 }
 
+/* App Store command entry callback */
+static void
+applemenu_app_store_command_changed(GtkEditable *editable, AppleMenuPlugin *applemenu)
+{
+    g_free(applemenu->app_store_command);
+    applemenu->app_store_command = g_strdup(gtk_entry_get_text(GTK_ENTRY(editable)));
+}
+
+/* Show recent items toggle callback */
+static void
+applemenu_show_recent_toggled(GtkToggleButton *button, AppleMenuPlugin *applemenu)
+{
+    AppleMenuEntry *entry;
+    
+    applemenu->show_recent_items = gtk_toggle_button_get_active(button);
+    
+    /* Patch the row in place instead of rebuilding the menu */
+    entry = applemenu_entry_find(applemenu, "recent");
+    if (entry != NULL)
+        applemenu_entry_sync(applemenu, entry);
+}
+
+/* Lock on sleep toggle callback */
+static void
+applemenu_lock_on_sleep_toggled(GtkToggleButton *button, AppleMenuPlugin *applemenu)
+{
+    applemenu->lock_on_sleep = gtk_toggle_button_get_active(button);
+}
+
+/* Shortcut entry callback, applied once editing is done */
+static void
+applemenu_shortcut_activate(GtkEntry *entry, AppleMenuPlugin *applemenu)
+{
+    const gchar *shortcut = gtk_entry_get_text(entry);
+    
+    if (g_strcmp0(shortcut, applemenu->popup_shortcut) == 0)
+        return;
+    
+    applemenu_hotkey_ungrab(applemenu);
+    g_free(applemenu->popup_shortcut);
+    applemenu->popup_shortcut = g_strdup(shortcut);
+    applemenu_hotkey_grab(applemenu);
+}
+
+static gboolean
+applemenu_shortcut_focus_out(GtkWidget *entry, GdkEvent *event G_GNUC_UNUSED, AppleMenuPlugin *applemenu)
+{
+    applemenu_shortcut_activate(GTK_ENTRY(entry), applemenu);
+    return FALSE;
+}
+
 /* Configuration dialog */
 static void
 applemenu_configure_plugin(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu)
@@ -713,6 +2332,14 @@ applemenu_configure_plugin(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu)
     GtkWidget *icon;
     gint row = 0;
     
+    /* Reuse the dialog if it was opened before */
+    if (applemenu->config_dialog) {
+        if (!gtk_widget_get_visible(applemenu->config_dialog))
+            xfce_panel_plugin_block_menu(plugin);
+        gtk_window_present(GTK_WINDOW(applemenu->config_dialog));
+        return;
+    }
+    
     /* Block plugin context menu */
     xfce_panel_plugin_block_menu(plugin);
     
@@ -732,6 +2359,11 @@ applemenu_configure_plugin(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu)
     g_signal_connect(G_OBJECT(dialog), "response",
                      G_CALLBACK(applemenu_configure_response), applemenu);
     
+    /* Keep a single instance around */
+    applemenu->config_dialog = dialog;
+    g_signal_connect(G_OBJECT(dialog), "destroy",
+                     G_CALLBACK(gtk_widget_destroyed), &applemenu->config_dialog);
+    
     /* Create grid for layout */
     content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
     grid = gtk_grid_new();
@@ -763,12 +2395,23 @@ applemenu_configure_plugin(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu)
     gtk_widget_set_hexpand(entry, TRUE);
     gtk_label_set_mnemonic_widget(GTK_LABEL(label), entry);
     g_signal_connect(G_OBJECT(entry), "changed",
-                     G_CALLBACK(g_free), applemenu->app_store_command);
-    g_signal_connect(G_OBJECT(entry), "changed",
-                     G_CALLBACK(g_strdup), &applemenu->app_store_command);
-    g_object_set_data(G_OBJECT(entry), "applemenu", applemenu);
+                     G_CALLBACK(applemenu_app_store_command_changed), applemenu);
+    gtk_grid_attach(GTK_GRID(grid), entry, 1, row++, 1, 1);
+    
+    /* Keyboard shortcut */
+    label = gtk_label_new_with_mnemonic(_("_Keyboard shortcut:"));
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+    gtk_grid_attach(GTK_GRID(grid), label, 0, row, 1, 1);
+    
+    entry = gtk_entry_new();
+    gtk_entry_set_text(GTK_ENTRY(entry), applemenu->popup_shortcut);
+    gtk_entry_set_placeholder_text(GTK_ENTRY(entry), "<Super>space");
+    gtk_widget_set_hexpand(entry, TRUE);
+    gtk_label_set_mnemonic_widget(GTK_LABEL(label), entry);
+    g_signal_connect(G_OBJECT(entry), "activate",
+                     G_CALLBACK(applemenu_shortcut_activate), applemenu);
     g_signal_connect(G_OBJECT(entry), "focus-out-event",
-                     G_CALLBACK(gtk_entry_get_text), entry);
+                     G_CALLBACK(applemenu_shortcut_focus_out), applemenu);
     gtk_grid_attach(GTK_GRID(grid), entry, 1, row++, 1, 1);
     
     /* Transparency */
@@ -790,7 +2433,14 @@ applemenu_configure_plugin(XfcePanelPlugin *plugin, AppleMenuPlugin *applemenu)
     check = gtk_check_button_new_with_mnemonic(_("Show _recent items"));
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check), applemenu->show_recent_items);
     g_signal_connect(G_OBJECT(check), "toggled",
-                     G_CALLBACK(gtk_toggle_button_get_active), &applemenu->show_recent_items);
+                     G_CALLBACK(applemenu_show_recent_toggled), applemenu);
+    gtk_grid_attach(GTK_GRID(grid), check, 0, row++, 2, 1);
+    
+    /* Lock screen on sleep */
+    check = gtk_check_button_new_with_mnemonic(_("_Lock screen when going to sleep"));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check), applemenu->lock_on_sleep);
+    g_signal_connect(G_OBJECT(check), "toggled",
+                     G_CALLBACK(applemenu_lock_on_sleep_toggled), applemenu);
     gtk_grid_attach(GTK_GRID(grid), check, 0, row++, 2, 1);
     
     /* Show dialog */
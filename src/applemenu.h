@@ -29,6 +29,17 @@ G_BEGIN_DECLS
 #define APPLEMENU_FALLBACK_ICON "distributor-logo"
 #define DEFAULT_APP_STORE_COMMAND "pamac-manager"
 #define DEFAULT_TRANSPARENCY 100
+#define DEFAULT_LOCK_ON_SLEEP FALSE
+#define DEFAULT_POPUP_SHORTCUT ""
+
+/* User menu items, relative to the XDG config directory */
+#define APPLEMENU_DROPIN_DIR "xfce4/panel/applemenu.d/"
+
+/* Built-in items sit at multiples of this step, leaving room in between */
+#define APPLEMENU_POSITION_STEP 10
+
+/* Longest wait for the screen locker before suspending anyway (ms) */
+#define APPLEMENU_SLEEP_LOCK_TIMEOUT 3000
 
 /* Menu item identifiers */
 typedef enum {
@@ -42,7 +53,9 @@ typedef enum {
     MENU_ITEM_RESTART,
     MENU_ITEM_SHUTDOWN,
     MENU_ITEM_LOCK,
-    MENU_ITEM_LOGOUT
+    MENU_ITEM_LOGOUT,
+    MENU_ITEM_POWER_PROFILE,
+    MENU_ITEM_CUSTOM        /* .desktop drop-in from APPLEMENU_DROPIN_DIR */
 } AppleMenuItemType;
 
 G_END_DECLS
@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2024-2025 Kamil 'Novik' Nowicki <novik@axisos.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Test driver: loads the plugin the way the panel does and runs commands
+ * against it, one per argument or, when there are none, one per line on
+ * stdin. Every command that succeeds ends its output with an "ok" line; the
+ * first failing command makes the driver exit with an error.
+ *
+ * Usage: applemenu-driver MODULE [COMMAND...]
+ *
+ * Commands:
+ *   pump MS          run the main loop for MS milliseconds
+ *   activate ID      activate the menu row with item id ID, e.g. sleep
+ *   items ID         print the submenu rows of row ID, one per line as
+ *                    LABEL<tab>ACTIVE<tab>SENSITIVE with 0/1 flags, and
+ *                    "-" for separators
+ *   select ID LABEL  activate the submenu row LABEL of row ID
+ *   lifecycle N      open, close and reconfigure the plugin N times and
+ *                    check that GObjects, toplevels and RSS stay flat and
+ *                    that the settings dialog stays a single instance
+ *                    (needs GOBJECT_DEBUG=instance-count)
+ */
+
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <gmodule.h>
+#include <libxfce4panel/libxfce4panel.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Lifecycle limits once the warm-up cycles have filled GTK's caches */
+#define DRIVER_OBJECT_SLACK   64
+#define DRIVER_RSS_SLACK_KB   8192
+
+/* Exported by XFCE_PANEL_PLUGIN_REGISTER, called by the panel's module loader */
+typedef XfcePanelPlugin *(*DriverModuleConstruct)(const gchar  *name,
+                                                  gint          unique_id,
+                                                  const gchar  *display_name,
+                                                  const gchar  *comment,
+                                                  gchar       **arguments,
+                                                  GdkScreen    *screen);
+
+typedef struct {
+    const gchar  *name;
+    gint          n_args;
+    gboolean    (*run)(gchar **args);
+} DriverCommand;
+
+typedef struct {
+    guint        objects;
+    guint        toplevels;
+    glong        rss_kb;
+    GHashTable  *counts;    /* GType -> instances of exactly that type */
+} DriverSnapshot;
+
+static DriverModuleConstruct  driver_module_construct;
+static GtkWidget             *driver_window;
+static GtkWidget             *driver_plugin;
+
+/* Run the main loop for a while so idles, D-Bus replies and redraws happen */
+static void
+driver_pump(guint ms)
+{
+    gint64 end = g_get_monotonic_time() + ms * G_TIME_SPAN_MILLISECOND;
+
+    do {
+        while (gtk_events_pending())
+            gtk_main_iteration();
+        g_usleep(G_TIME_SPAN_MILLISECOND);
+    } while (g_get_monotonic_time() < end);
+}
+
+/* Construct a plugin in its own window, like a one-plugin panel */
+static GtkWidget *
+driver_plugin_new(gint unique_id, GtkWidget **window)
+{
+    GtkWidget *plugin;
+
+    plugin = GTK_WIDGET(driver_module_construct("applemenu", unique_id, "Apple Menu", "", NULL,
+                                                gdk_screen_get_default()));
+    if (plugin == NULL)
+        return NULL;
+
+    *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_container_add(GTK_CONTAINER(*window), plugin);
+    gtk_widget_show_all(*window);
+    driver_pump(50);
+
+    return plugin;
+}
+
+static void
+driver_plugin_popup(GtkWidget *plugin)
+{
+    gtk_button_clicked(GTK_BUTTON(gtk_bin_get_child(GTK_BIN(plugin))));
+    driver_pump(1);
+}
+
+/* The menu attached to the plugin's button */
+static GtkWidget *
+driver_plugin_menu(void)
+{
+    GList *menus;
+
+    menus = gtk_menu_get_for_attach_widget(gtk_bin_get_child(GTK_BIN(driver_plugin)));
+
+    return menus != NULL ? menus->data : NULL;
+}
+
+/* Menu row named after an item id, the plugin names its rows that way */
+static GtkWidget *
+driver_find_item(GtkWidget *menu, const gchar *id)
+{
+    GList *children, *li;
+    GtkWidget *item = NULL;
+
+    if (menu == NULL)
+        return NULL;
+
+    children = gtk_container_get_children(GTK_CONTAINER(menu));
+    for (li = children; li != NULL && item == NULL; li = li->next) {
+        if (g_strcmp0(gtk_widget_get_name(li->data), id) == 0)
+            item = li->data;
+    }
+    g_list_free(children);
+
+    return item;
+}
+
+/* Submenu of the row named id */
+static GtkWidget *
+driver_find_submenu(const gchar *id)
+{
+    GtkWidget *item;
+
+    item = driver_find_item(driver_plugin_menu(), id);
+    if (item == NULL || gtk_menu_item_get_submenu(GTK_MENU_ITEM(item)) == NULL) {
+        g_printerr("No submenu under \"%s\"\n", id);
+        return NULL;
+    }
+
+    return gtk_menu_item_get_submenu(GTK_MENU_ITEM(item));
+}
+
+/* Answer every open dialog like the Close button would */
+static void
+driver_close_dialogs(void)
+{
+    GList *windows, *li;
+
+    windows = gtk_window_list_toplevels();
+    for (li = windows; li != NULL; li = li->next) {
+        if (GTK_IS_DIALOG(li->data) && gtk_widget_get_visible(li->data))
+            gtk_dialog_response(GTK_DIALOG(li->data), GTK_RESPONSE_OK);
+    }
+    g_list_free(windows);
+}
+
+static guint
+driver_count_dialogs(void)
+{
+    GList *windows, *li;
+    guint n_dialogs = 0;
+
+    windows = gtk_window_list_toplevels();
+    for (li = windows; li != NULL; li = li->next) {
+        if (GTK_IS_DIALOG(li->data))
+            n_dialogs++;
+    }
+    g_list_free(windows);
+
+    return n_dialogs;
+}
+
+/* Live instances of type and all of its subtypes */
+static guint
+driver_count_instances(GType type, GHashTable *counts)
+{
+    GType *children;
+    guint n_children, i, count, total;
+
+    count = g_type_get_instance_count(type);
+    if (count > 0)
+        g_hash_table_insert(counts, GSIZE_TO_POINTER(type), GUINT_TO_POINTER(count));
+
+    total = count;
+    children = g_type_children(type, &n_children);
+    for (i = 0; i < n_children; i++)
+        total += driver_count_instances(children[i], counts);
+    g_free(children);
+
+    return total;
+}
+
+static glong
+driver_rss_kb(void)
+{
+    gchar *contents = NULL;
+    glong size = 0, resident = 0;
+
+    if (g_file_get_contents("/proc/self/statm", &contents, NULL, NULL))
+        sscanf(contents, "%ld %ld", &size, &resident);
+    g_free(contents);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void
+driver_snapshot(DriverSnapshot *snapshot)
+{
+    GList *windows;
+
+    /* Let finalizers and idle teardown run first */
+    driver_pump(20);
+
+    snapshot->counts = g_hash_table_new(g_direct_hash, g_direct_equal);
+    snapshot->objects = driver_count_instances(G_TYPE_OBJECT, snapshot->counts);
+
+    windows = gtk_window_list_toplevels();
+    snapshot->toplevels = g_list_length(windows);
+    g_list_free(windows);
+
+    snapshot->rss_kb = driver_rss_kb();
+}
+
+/* Print the types whose instance count grew between two snapshots */
+static void
+driver_snapshot_diff(DriverSnapshot *before, DriverSnapshot *after)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    guint old_count;
+
+    g_hash_table_iter_init(&iter, after->counts);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        old_count = GPOINTER_TO_UINT(g_hash_table_lookup(before->counts, key));
+        if (GPOINTER_TO_UINT(value) > old_count)
+            g_printerr("  %s: %u -> %u\n", g_type_name(GPOINTER_TO_SIZE(key)),
+                       old_count, GPOINTER_TO_UINT(value));
+    }
+}
+
+/* One open/close/reconfigure round, FALSE when a check fails */
+static gboolean
+driver_lifecycle_cycle(guint cycle, const gchar *dropin)
+{
+    GtkWidget *window, *plugin;
+    GValue value = G_VALUE_INIT;
+    gboolean handled, result;
+    guint n_dialogs;
+
+    /* Open and close by click and by remote event */
+    driver_plugin_popup(driver_plugin);
+    driver_plugin_popup(driver_plugin);
+
+    g_value_init(&value, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&value, TRUE);
+    g_signal_emit_by_name(driver_plugin, "remote-event", "popup", &value, &handled);
+    driver_pump(1);
+    g_signal_emit_by_name(driver_plugin, "remote-event", "popup", &value, &handled);
+    driver_pump(1);
+    g_value_unset(&value);
+
+    /* Panel resize */
+    g_signal_emit_by_name(driver_plugin, "size-changed", 16 + (cycle % 4) * 8, &result);
+
+    /* Asking for the settings twice must present the same dialog */
+    g_signal_emit_by_name(driver_plugin, "configure-plugin");
+    g_signal_emit_by_name(driver_plugin, "configure-plugin");
+    driver_pump(1);
+
+    n_dialogs = driver_count_dialogs();
+    if (n_dialogs != 1) {
+        g_printerr("cycle %u: %u settings dialogs instead of one\n", cycle, n_dialogs);
+        return FALSE;
+    }
+
+    driver_close_dialogs();
+    g_signal_emit_by_name(driver_plugin, "save");
+    driver_pump(1);
+
+    /* Add and remove a drop-in item */
+    if (cycle % 50 == 0) {
+        g_file_set_contents(dropin,
+                            "[Desktop Entry]\n"
+                            "Type=Application\n"
+                            "Name=Driver\n"
+                            "Exec=true\n", -1, NULL);
+        driver_pump(20);
+        g_unlink(dropin);
+        driver_pump(20);
+    }
+
+    /* Full construct and teardown of a second plugin */
+    if (cycle % 100 == 0) {
+        plugin = driver_plugin_new(2, &window);
+        if (plugin == NULL) {
+            g_printerr("cycle %u: second plugin was not constructed\n", cycle);
+            return FALSE;
+        }
+
+        driver_plugin_popup(plugin);
+        g_signal_emit_by_name(plugin, "configure-plugin");
+        driver_pump(5);
+        gtk_widget_destroy(window);
+        driver_pump(5);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+driver_cmd_pump(gchar **args)
+{
+    driver_pump(atoi(args[0]));
+    return TRUE;
+}
+
+static gboolean
+driver_cmd_activate(gchar **args)
+{
+    GtkWidget *item;
+
+    item = driver_find_item(driver_plugin_menu(), args[0]);
+    if (item == NULL) {
+        g_printerr("No menu item \"%s\"\n", args[0]);
+        return FALSE;
+    }
+
+    gtk_menu_item_activate(GTK_MENU_ITEM(item));
+
+    return TRUE;
+}
+
+static gboolean
+driver_cmd_items(gchar **args)
+{
+    GtkWidget *submenu;
+    GList *children, *li;
+    gboolean active;
+
+    submenu = driver_find_submenu(args[0]);
+    if (submenu == NULL)
+        return FALSE;
+
+    children = gtk_container_get_children(GTK_CONTAINER(submenu));
+    for (li = children; li != NULL; li = li->next) {
+        if (GTK_IS_SEPARATOR_MENU_ITEM(li->data)) {
+            g_print("-\n");
+            continue;
+        }
+
+        active = GTK_IS_CHECK_MENU_ITEM(li->data)
+                 && gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(li->data));
+        g_print("%s\t%d\t%d\n", gtk_menu_item_get_label(GTK_MENU_ITEM(li->data)),
+                active, gtk_widget_get_sensitive(li->data));
+    }
+    g_list_free(children);
+
+    return TRUE;
+}
+
+static gboolean
+driver_cmd_select(gchar **args)
+{
+    GtkWidget *submenu, *item = NULL;
+    GList *children, *li;
+
+    submenu = driver_find_submenu(args[0]);
+    if (submenu == NULL)
+        return FALSE;
+
+    children = gtk_container_get_children(GTK_CONTAINER(submenu));
+    for (li = children; li != NULL && item == NULL; li = li->next) {
+        if (!GTK_IS_SEPARATOR_MENU_ITEM(li->data)
+            && g_strcmp0(gtk_menu_item_get_label(GTK_MENU_ITEM(li->data)), args[1]) == 0)
+            item = li->data;
+    }
+    g_list_free(children);
+
+    if (item == NULL) {
+        g_printerr("No \"%s\" under \"%s\"\n", args[1], args[0]);
+        return FALSE;
+    }
+
+    gtk_menu_item_activate(GTK_MENU_ITEM(item));
+
+    return TRUE;
+}
+
+static gboolean
+driver_cmd_lifecycle(gchar **args)
+{
+    DriverSnapshot before, after;
+    gchar *dropin_dir, *dropin;
+    guint cycles, warm_up, i;
+    gboolean ok = TRUE;
+
+    if (strstr(g_getenv("GOBJECT_DEBUG") ? g_getenv("GOBJECT_DEBUG") : "", "instance-count") == NULL) {
+        g_printerr("lifecycle needs GOBJECT_DEBUG=instance-count\n");
+        return FALSE;
+    }
+
+    cycles = MAX(atoi(args[0]), 4);
+    warm_up = cycles / 4;
+
+    dropin_dir = g_build_filename(g_get_user_config_dir(), "xfce4", "panel", "applemenu.d", NULL);
+    dropin = g_build_filename(dropin_dir, "driver.desktop", NULL);
+    g_mkdir_with_parents(dropin_dir, 0700);
+
+    /* Warm up GTK's caches, then measure over the remaining cycles */
+    for (i = 0; i < warm_up && ok; i++)
+        ok = driver_lifecycle_cycle(i, dropin);
+
+    driver_snapshot(&before);
+
+    for (; i < cycles && ok; i++)
+        ok = driver_lifecycle_cycle(i, dropin);
+
+    driver_snapshot(&after);
+
+    if (ok) {
+        g_print("lifecycle: %u cycles, objects %u -> %u, toplevels %u -> %u, rss %ld -> %ld kB\n",
+                cycles, before.objects, after.objects, before.toplevels, after.toplevels,
+                before.rss_kb, after.rss_kb);
+
+        if (after.toplevels != before.toplevels) {
+            g_printerr("toplevel windows grew from %u to %u\n", before.toplevels, after.toplevels);
+            ok = FALSE;
+        }
+
+        if (after.objects > before.objects + DRIVER_OBJECT_SLACK) {
+            g_printerr("GObject instances grew from %u to %u:\n", before.objects, after.objects);
+            driver_snapshot_diff(&before, &after);
+            ok = FALSE;
+        }
+
+        if (after.rss_kb > before.rss_kb + DRIVER_RSS_SLACK_KB) {
+            g_printerr("RSS grew from %ld to %ld kB\n", before.rss_kb, after.rss_kb);
+            ok = FALSE;
+        }
+    }
+
+    g_hash_table_destroy(before.counts);
+    g_hash_table_destroy(after.counts);
+    g_free(dropin);
+    g_free(dropin_dir);
+
+    return ok;
+}
+
+static const DriverCommand driver_commands[] = {
+    { "pump",       1, driver_cmd_pump },
+    { "activate",   1, driver_cmd_activate },
+    { "items",      1, driver_cmd_items },
+    { "select",     2, driver_cmd_select },
+    { "lifecycle",  1, driver_cmd_lifecycle },
+};
+
+/* Parse and run one command line */
+static gboolean
+driver_run(const gchar *line)
+{
+    GError *error = NULL;
+    gchar **argv;
+    gint argc;
+    guint i;
+    gboolean ok = FALSE;
+
+    if (!g_shell_parse_argv(line, &argc, &argv, &error)) {
+        g_printerr("Invalid command \"%s\": %s\n", line, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(driver_commands); i++) {
+        if (g_strcmp0(argv[0], driver_commands[i].name) != 0)
+            continue;
+
+        if (argc - 1 != driver_commands[i].n_args) {
+            g_printerr("%s takes %d arguments\n", argv[0], driver_commands[i].n_args);
+            break;
+        }
+
+        ok = driver_commands[i].run(argv + 1);
+        break;
+    }
+
+    if (i == G_N_ELEMENTS(driver_commands))
+        g_printerr("Unknown command \"%s\"\n", argv[0]);
+
+    if (ok)
+        g_print("ok\n");
+    fflush(stdout);
+
+    g_strfreev(argv);
+
+    return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+    GModule *module;
+    gchar line[1024];
+    gboolean ok = TRUE;
+    gint i;
+
+    gtk_init(&argc, &argv);
+
+    if (argc < 2) {
+        g_printerr("Usage: %s MODULE [COMMAND...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    module = g_module_open(argv[1], G_MODULE_BIND_LOCAL);
+    if (module == NULL) {
+        g_printerr("Failed to load %s: %s\n", argv[1], g_module_error());
+        return EXIT_FAILURE;
+    }
+    g_module_make_resident(module);
+
+    if (!g_module_symbol(module, "xfce_panel_module_construct", (gpointer *)&driver_module_construct)) {
+        g_printerr("%s is not a panel plugin\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    driver_plugin = driver_plugin_new(1, &driver_window);
+    if (driver_plugin == NULL) {
+        g_printerr("%s did not construct a plugin\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc > 2) {
+        for (i = 2; i < argc && ok; i++)
+            ok = driver_run(argv[i]);
+    } else {
+        while (ok && fgets(line, sizeof(line), stdin) != NULL) {
+            g_strstrip(line);
+            if (*line != '\0')
+                ok = driver_run(line);
+        }
+    }
+
+    /* Tear the plugin down so leak checking covers free-data too */
+    gtk_widget_destroy(driver_window);
+    driver_pump(50);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
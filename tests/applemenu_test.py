@@ -0,0 +1,94 @@
+#
+# Copyright (C) 2024-2025 Kamil 'Novik' Nowicki <novik@axisos.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+'''Helpers shared by the D-Bus tests, which run through run-test.sh as
+test-*.py DRIVER MODULE.'''
+
+import os
+import subprocess
+import sys
+
+# Meson counts exit code 77 as a skipped test
+SKIP = 77
+
+try:
+    import dbusmock  # noqa: F401
+except ImportError:
+    print('python-dbusmock not found, skipping', file=sys.stderr)
+    sys.exit(SKIP)
+
+if len(sys.argv) < 3:
+    print(f'Usage: {sys.argv[0]} DRIVER MODULE', file=sys.stderr)
+    sys.exit(1)
+
+DRIVER, MODULE = sys.argv[1:3]
+del sys.argv[1:3]
+
+
+def write_config(**settings):
+    '''Write the rc file of plugin 1, keys use dashes like the plugin does'''
+    path = os.path.join(os.environ['XDG_CONFIG_HOME'], 'xfce4', 'panel', 'applemenu-1.rc')
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'w') as rc:
+        for key, value in settings.items():
+            if isinstance(value, bool):
+                value = 'true' if value else 'false'
+            rc.write(f'{key.replace("_", "-")}={value}\n')
+
+
+class Driver:
+    '''applemenu-driver reading commands from stdin'''
+
+    def __init__(self, env=None):
+        env = dict(env or os.environ)
+        # Debug messages go to stdout and would mix with command output
+        env.pop('G_MESSAGES_DEBUG', None)
+        self.proc = subprocess.Popen([DRIVER, MODULE],
+                                     stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE,
+                                     env=env,
+                                     universal_newlines=True,
+                                     bufsize=1)
+
+    def send(self, command):
+        '''Send a command without waiting for it to finish'''
+        self.proc.stdin.write(command + '\n')
+        self.proc.stdin.flush()
+
+    def wait(self):
+        '''Output lines of the oldest command still running'''
+        lines = []
+        while True:
+            line = self.proc.stdout.readline()
+            if not line:
+                raise AssertionError(f'driver failed with exit code {self.proc.wait()}')
+            line = line.rstrip('\n')
+            if line == 'ok':
+                return lines
+            lines.append(line)
+
+    def run(self, command):
+        self.send(command)
+        return self.wait()
+
+    def close(self):
+        '''Tear the plugin down, returns the driver's exit code'''
+        self.proc.stdin.close()
+        try:
+            return self.proc.wait(timeout=60)
+        finally:
+            self.proc.stdout.close()
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Run a test on a private session bus and a display, with its own
+# configuration directory. Exits with 77 (skipped) when there is no
+# dbus-run-session, or no display and no xvfb-run.
+#
+# Usage: run-test.sh COMMAND [ARGS...]
+
+set -e
+
+TESTS_DIR=$(cd "$(dirname "$0")" && pwd)
+
+if ! command -v dbus-run-session >/dev/null 2>&1; then
+    echo "dbus-run-session not found, skipping" >&2
+    exit 77
+fi
+
+# Keep the tests away from the user's own configuration and recent files
+TEST_HOME=$(mktemp -d)
+trap 'rm -rf "$TEST_HOME"' EXIT
+XDG_CONFIG_HOME="$TEST_HOME/config"
+XDG_DATA_HOME="$TEST_HOME/data"
+XDG_CACHE_HOME="$TEST_HOME/cache"
+export XDG_CONFIG_HOME XDG_DATA_HOME XDG_CACHE_HOME
+
+# The session bus config has no service directories, so nothing real gets
+# activated behind the mocks
+set -- dbus-run-session --config-file="$TESTS_DIR/session.conf" -- "$@"
+
+if [ -z "$DISPLAY" ]; then
+    if ! command -v xvfb-run >/dev/null 2>&1; then
+        echo "No display and no xvfb-run, skipping" >&2
+        exit 77
+    fi
+    set -- xvfb-run -a "$@"
+fi
+
+"$@"
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2024-2025 Kamil 'Novik' Nowicki <novik@axisos.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+'''Performance Mode submenu against a mock power-profiles-daemon on a
+private system bus.'''
+
+import os
+import re
+import shutil
+import tempfile
+import unittest
+
+from applemenu_test import Driver
+
+import dbus
+import dbusmock
+
+PPD_IFACE = 'net.hadess.PowerProfiles'
+
+# The mock logs every Properties.Set it handles
+SET_ACTIVE_PROFILE = re.compile(r'Set ' + re.escape(PPD_IFACE) + r'\.ActiveProfile')
+
+
+class PowerProfilesTest(dbusmock.DBusTestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.start_system_bus()
+
+    def setUp(self):
+        self.tmp = tempfile.mkdtemp()
+        self.log = open(os.path.join(self.tmp, 'ppd.log'), 'w+')
+
+        self.ppd, self.ppd_obj = self.spawn_server_template(
+            'power_profiles_daemon', {}, stdout=self.log)
+        self.props = dbus.Interface(self.ppd_obj, dbus.PROPERTIES_IFACE)
+
+        # Known profiles and no degradation, whatever the template defaults to
+        try:
+            self.ppd_obj.AddProperty(PPD_IFACE, 'PerformanceDegraded', '')
+        except dbus.exceptions.DBusException:
+            pass
+        self.set_property('Profiles', dbus.Array(
+            [dbus.Dictionary({'Profile': profile, 'Driver': 'dbusmock'}, signature='sv')
+             for profile in ('power-saver', 'balanced', 'performance')],
+            signature='a{sv}'))
+        self.set_property('ActiveProfile', 'balanced')
+        self.set_property('PerformanceDegraded', '')
+
+        self.driver = Driver()
+        # Let the plugin connect and fill the submenu
+        self.driver.run('pump 1000')
+
+    def tearDown(self):
+        self.assertEqual(self.driver.close(), 0)
+        self.ppd.terminate()
+        self.ppd.wait()
+        self.log.close()
+        shutil.rmtree(self.tmp)
+
+    def set_property(self, name, value):
+        self.props.Set(PPD_IFACE, name, value)
+
+    def items(self):
+        '''Submenu rows as (label, active, sensitive)'''
+        self.driver.run('pump 300')
+        return [tuple(line.split('\t')) for line in self.driver.run('items power-profile')]
+
+    def active_profiles(self):
+        return [row[0] for row in self.items() if len(row) == 3 and row[1] == '1']
+
+    def test_lists_profiles(self):
+        self.assertEqual(self.items(), [
+            ('Power Saver', '0', '1'),
+            ('Balanced', '1', '1'),
+            ('Performance', '0', '1'),
+        ])
+
+    def test_follows_active_profile(self):
+        self.set_property('ActiveProfile', 'power-saver')
+        self.assertEqual(self.active_profiles(), ['Power Saver'])
+
+        self.set_property('ActiveProfile', 'performance')
+        self.assertEqual(self.active_profiles(), ['Performance'])
+
+    def test_select_sets_once(self):
+        self.log.flush()
+        offset = os.path.getsize(self.log.name)
+
+        self.driver.run('select power-profile Performance')
+        self.driver.run('pump 500')
+
+        with open(self.log.name) as log:
+            log.seek(offset)
+            sets = [line for line in log if SET_ACTIVE_PROFILE.search(line)]
+        self.assertEqual(len(sets), 1, sets)
+        self.assertEqual(self.props.Get(PPD_IFACE, 'ActiveProfile'), 'performance')
+        self.assertEqual(self.active_profiles(), ['Performance'])
+
+    def test_degraded_reason(self):
+        self.set_property('PerformanceDegraded', 'lap-detected')
+        rows = self.items()
+        self.assertIn('-', [row[0] for row in rows])
+        self.assertEqual(rows[-1], ('Performance limited: computer is on a lap', '0', '0'))
+
+        self.set_property('PerformanceDegraded', '')
+        self.assertNotIn('-', [row[0] for row in self.items()])
+
+
+if __name__ == '__main__':
+    unittest.main()
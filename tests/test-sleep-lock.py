@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2024-2025 Kamil 'Novik' Nowicki <novik@axisos.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+'''Lock on sleep against mock logind and screen saver services.
+
+The logind mock hands out the write end of a FIFO as the delay inhibitor,
+so the test sees the exact moment the plugin closes it: only after the
+locker answered Lock, or reported itself active, or once the timeout
+expired.
+'''
+
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+import unittest
+
+from applemenu_test import Driver, write_config
+
+import dbusmock
+
+LOGIND_MANAGER_IFACE = 'org.freedesktop.login1.Manager'
+SCREENSAVER_IFACE = 'org.gnome.ScreenSaver'
+
+# APPLEMENU_SLEEP_LOCK_TIMEOUT
+LOCK_TIMEOUT = 3.0
+
+
+class SleepLockTest(dbusmock.DBusTestCase):
+    @classmethod
+    def setUpClass(cls):
+        # The session bus comes from run-test.sh, logind gets a private system bus
+        cls.start_system_bus()
+        write_config(lock_on_sleep=True)
+
+    def setUp(self):
+        self.tmp = tempfile.mkdtemp()
+
+        # The inhibitor: whoever holds the write end keeps the read end open
+        self.fifo = os.path.join(self.tmp, 'inhibitor')
+        os.mkfifo(self.fifo)
+        self.inhibitor = os.open(self.fifo, os.O_RDONLY | os.O_NONBLOCK)
+
+        self.logind, self.logind_obj = self.spawn_server_template(
+            'logind', {}, stdout=subprocess.DEVNULL)
+        self.logind_obj.AddMethod(
+            LOGIND_MANAGER_IFACE, 'Inhibit', 'ssss', 'h',
+            'import os\n'
+            'import dbus\n'
+            f'fd = os.open({self.fifo!r}, os.O_WRONLY | os.O_NONBLOCK)\n'
+            'ret = dbus.types.UnixFd(fd)\n'
+            'os.close(fd)\n')
+        # Accept the suspend without doing anything
+        self.logind_obj.AddMethod(LOGIND_MANAGER_IFACE, 'Suspend', 'b', '', '')
+
+        # Fallback locker, only records that it ran
+        self.xflock4_ran = os.path.join(self.tmp, 'xflock4-ran')
+        xflock4 = os.path.join(self.tmp, 'xflock4')
+        with open(xflock4, 'w') as script:
+            script.write(f'#!/bin/sh\ntouch {self.xflock4_ran}\n')
+        os.chmod(xflock4, 0o755)
+        self.env = dict(os.environ, PATH=self.tmp + os.pathsep + os.environ['PATH'])
+
+        self.locker = None
+        self.driver = None
+
+    def tearDown(self):
+        if self.driver:
+            self.assertEqual(self.driver.close(), 0)
+        for mock in (self.locker, self.logind):
+            if mock:
+                mock.terminate()
+                mock.wait()
+        os.close(self.inhibitor)
+        shutil.rmtree(self.tmp)
+
+    def start_locker(self, lock_delay):
+        '''gnome-screensaver mock whose Lock replies after lock_delay seconds'''
+        self.locker, self.locker_obj = self.spawn_server_template(
+            'gnome_screensaver', {}, stdout=subprocess.DEVNULL)
+        self.locker_obj.AddMethod(SCREENSAVER_IFACE, 'Lock', '', '',
+                                  f'import time\ntime.sleep({lock_delay})\n')
+
+    def start_driver(self):
+        self.driver = Driver(self.env)
+        # Give the plugin time to look for a screen locker
+        self.driver.run('pump 1000')
+
+    def sleep(self, pump_ms=6000, at=None):
+        '''Activate Sleep and return the seconds until the inhibitor was
+        released, None if it was never taken or never released. at is an
+        optional (seconds, callback) to run while waiting.'''
+        self.driver.send('activate sleep')
+        self.driver.send(f'pump {pump_ms}')
+        start = time.monotonic()
+
+        taken = False
+        released = None
+        while released is None and time.monotonic() - start < pump_ms / 1000:
+            if at and time.monotonic() - start >= at[0]:
+                at[1]()
+                at = None
+            try:
+                data = os.read(self.inhibitor, 1)
+            except BlockingIOError:
+                # A writer holds the inhibitor
+                taken = True
+            else:
+                # End of file once the last writer is gone
+                if data == b'' and taken:
+                    released = time.monotonic() - start
+            time.sleep(0.01)
+
+        self.driver.wait()
+        self.driver.wait()
+
+        self.assertTrue(taken, 'no delay inhibitor was taken')
+        return released
+
+    def assert_inhibit_before_suspend(self):
+        calls = [(name, args) for _, name, args in self.logind_obj.GetCalls()
+                 if name in ('Inhibit', 'Suspend')]
+        self.assertEqual([name for name, _ in calls], ['Inhibit', 'Suspend'])
+        self.assertEqual(calls[0][1][0], 'sleep')
+        self.assertEqual(calls[0][1][3], 'delay')
+
+    def locker_calls(self):
+        return [name for _, name, _ in self.locker_obj.GetCalls()]
+
+    def test_release_on_lock_reply(self):
+        self.start_locker(lock_delay=1.0)
+        self.start_driver()
+
+        released = self.sleep()
+
+        self.assert_inhibit_before_suspend()
+        self.assertIn('Lock', self.locker_calls())
+        self.assertIsNotNone(released, 'inhibitor was never released')
+        # Held while Lock was pending, released on its reply, not on the timeout
+        self.assertGreaterEqual(released, 0.9)
+        self.assertLess(released, LOCK_TIMEOUT - 0.5)
+
+    def test_release_on_timeout(self):
+        self.start_locker(lock_delay=LOCK_TIMEOUT + 2)
+        self.start_driver()
+
+        released = self.sleep()
+
+        self.assert_inhibit_before_suspend()
+        self.assertIsNotNone(released, 'inhibitor was never released')
+        self.assertGreaterEqual(released, LOCK_TIMEOUT - 0.2)
+        self.assertLess(released, LOCK_TIMEOUT + 1.5)
+
+    def test_fallback_waits_for_timeout(self):
+        # No locker on the bus: xflock4 is spawned, which proves nothing
+        self.start_driver()
+
+        released = self.sleep()
+
+        self.assert_inhibit_before_suspend()
+        self.assertTrue(os.path.exists(self.xflock4_ran), 'xflock4 was not spawned')
+        self.assertIsNotNone(released, 'inhibitor was never released')
+        self.assertGreaterEqual(released, LOCK_TIMEOUT - 0.2)
+        self.assertLess(released, LOCK_TIMEOUT + 1.5)
+
+    def test_fallback_releases_on_active_changed(self):
+        # The plugin starts without a locker, then one comes up after xflock4
+        self.start_driver()
+        self.start_locker(lock_delay=0)
+
+        def locked():
+            self.locker_obj.EmitSignal(SCREENSAVER_IFACE, 'ActiveChanged', 'b', [True])
+
+        released = self.sleep(at=(1.0, locked))
+
+        self.assert_inhibit_before_suspend()
+        self.assertTrue(os.path.exists(self.xflock4_ran), 'xflock4 was not spawned')
+        self.assertIsNotNone(released, 'inhibitor was never released')
+        self.assertGreaterEqual(released, 0.9)
+        self.assertLess(released, LOCK_TIMEOUT - 0.5)
+
+
+if __name__ == '__main__':
+    unittest.main()